@@ -0,0 +1,135 @@
+/*
+  ==============================================================================
+
+    Distortion with the oversampled waveshaper against ADAAWaveShaper: time per
+    sample and how much aliasing is left for a sine, to see which costs less
+    for the same amount of aliasing.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "BenchmarkUtilities.h"
+
+//==============================================================================
+namespace AdaaBenchmark
+{
+    using Filter = Distortion<float>::OversamplingFilter;
+
+    constexpr int blockSize = 512;
+    constexpr double sampleRate = 48000.0;
+
+    //正弦波がちょうどFFTのビンに乗るようにして、窓をかけずに測る
+    constexpr int fftOrder = 13, fftSize = 1 << fftOrder;
+    constexpr int sineBin = 427;   // 2502 Hz
+
+    /** Median time of one stereo block of noise in nanoseconds */
+    template <typename DistortionType>
+    double measureTime (DistortionType& distortion)
+    {
+        juce::ScopedNoDenormals noDenormals;
+
+        distortion.prepare ({ sampleRate, (juce::uint32) blockSize, 2 });
+
+        juce::AudioBuffer<float> source (2, blockSize), buffer (2, blockSize);
+
+        for (int ch = 0; ch < 2; ++ch)
+            BenchmarkUtilities::fillWithNoise (source.getWritePointer (ch), (size_t) blockSize, 0.5f, (juce::uint32) ch + 1);
+
+        return BenchmarkUtilities::measureMedianNanoseconds (500, [&]
+        {
+            buffer.makeCopyOf (source, true);
+            juce::dsp::AudioBlock<float> block (buffer);
+            distortion.process (juce::dsp::ProcessContextReplacing<float> (block));
+            BenchmarkUtilities::doNotOptimise (buffer.getSample (0, 0));
+        });
+    }
+
+    /** Power of everything that isn't a harmonic of the sine, relative to the harmonics, in dB */
+    template <typename DistortionType>
+    double measureAliasing (DistortionType& distortion)
+    {
+        juce::ScopedNoDenormals noDenormals;
+
+        distortion.prepare ({ sampleRate, (juce::uint32) blockSize, 2 });
+
+        //フィルターの過渡応答が消えるまで流してから、最後のfftSizeサンプルを解析する
+        constexpr int numBlocks = 4 * fftSize / blockSize;
+        std::vector<float> output ((size_t) numBlocks * blockSize);
+        juce::AudioBuffer<float> buffer (2, blockSize);
+
+        for (int b = 0, n = 0; b < numBlocks; ++b)
+        {
+            for (int i = 0; i < blockSize; ++i, ++n)
+            {
+                auto phase = juce::MathConstants<double>::twoPi * sineBin * (n % fftSize) / fftSize;
+                buffer.setSample (0, i, 0.5f * (float) std::sin (phase));
+                buffer.setSample (1, i, buffer.getSample (0, i));
+            }
+
+            juce::dsp::AudioBlock<float> block (buffer);
+            distortion.process (juce::dsp::ProcessContextReplacing<float> (block));
+            std::copy (buffer.getReadPointer (0), buffer.getReadPointer (0) + blockSize, output.data() + b * blockSize);
+        }
+
+        std::vector<float> spectrum (2 * fftSize, 0.0f);
+        std::copy (output.end() - fftSize, output.end(), spectrum.begin());
+        juce::dsp::FFT (fftOrder).performFrequencyOnlyForwardTransform (spectrum.data());
+
+        double harmonics = 0.0, others = 0.0;
+
+        for (int bin = 1; bin < fftSize / 2; ++bin)
+        {
+            auto power = (double) spectrum[(size_t) bin] * spectrum[(size_t) bin];
+            (bin % sineBin == 0 ? harmonics : others) += power;
+        }
+
+        return 10.0 * std::log10 (others / harmonics);
+    }
+
+    template <typename DistortionType>
+    void print (const char* name, DistortionType& distortion, double baseTime)
+    {
+        auto aliasing = measureAliasing (distortion);
+        auto time = measureTime (distortion);
+
+        std::printf ("%-14s %6.2f ns/sample, %5.2fx the cost of 1x, aliasing %6.1f dB, latency %5.1f samples\n",
+                     name, time / (2.0 * blockSize), time / baseTime, aliasing, (double) distortion.getLatencyInSamples());
+    }
+
+    inline void run()
+    {
+        BenchmarkUtilities::printTitle ("adaa: aliasing against cost, oversampling and ADAA");
+        std::printf ("stereo, block %d, 48 kHz; aliasing of a %.0f Hz sine at -6 dB\n",
+                     blockSize, sampleRate * sineBin / fftSize);
+
+        Distortion<float> base;
+        auto baseTime = measureTime (base);
+        print ("1x", base, baseTime);
+
+        for (auto filterType : { Filter::polyphaseIIR, Filter::equirippleFIR })
+        {
+            for (size_t factorLog2 = 1; factorLog2 <= 3; ++factorLog2)
+            {
+                Distortion<float> distortion;
+                distortion.setOversampling (factorLog2, filterType);
+
+                auto name = juce::String (filterType == Filter::polyphaseIIR ? "IIR " : "FIR ") + juce::String (1 << factorLog2) + "x";
+                print (name.toRawUTF8(), distortion, baseTime);
+            }
+        }
+
+        Distortion<float, FastTanh, ADAAWaveShaper<float, ADAAFunctions::Tanh, 1>> adaa1;
+        print ("ADAA tanh 1st", adaa1, baseTime);
+
+        Distortion<float, FastTanh, ADAAWaveShaper<float, ADAAFunctions::Tanh, 2>> adaa2;
+        print ("ADAA tanh 2nd", adaa2, baseTime);
+
+        Distortion<float, FastTanh, ADAAWaveShaper<float, ADAAFunctions::HardClip, 1>> clip1;
+        print ("ADAA clip 1st", clip1, baseTime);
+
+        Distortion<float, FastTanh, ADAAWaveShaper<float, ADAAFunctions::HardClip, 2>> clip2;
+        print ("ADAA clip 2nd", clip2, baseTime);
+    }
+}
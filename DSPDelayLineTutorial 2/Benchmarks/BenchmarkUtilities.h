@@ -0,0 +1,67 @@
+/*
+  ==============================================================================
+
+    Timing helpers shared by the benchmarks.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+//==============================================================================
+namespace BenchmarkUtilities
+{
+    /** Runs function numRuns times after one warm-up run and returns the median time
+        of a single run in nanoseconds. The median keeps one preempted run from
+        skewing the result.
+    */
+    template <typename Function>
+    double measureMedianNanoseconds (int numRuns, Function&& function)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        function();
+
+        std::vector<double> times;
+        times.reserve ((size_t) numRuns);
+
+        for (int i = 0; i < numRuns; ++i)
+        {
+            auto start = Clock::now();
+            function();
+            times.push_back (std::chrono::duration<double, std::nano> (Clock::now() - start).count());
+        }
+
+        std::sort (times.begin(), times.end());
+        return times[times.size() / 2];
+    }
+
+    /** Fills the buffer with a deterministic pseudo-random signal in [-amplitude, amplitude] */
+    template <typename Type>
+    void fillWithNoise (Type* data, size_t numSamples, Type amplitude, juce::uint32 seed = 1)
+    {
+        juce::Random random ((juce::int64) seed);
+
+        for (size_t i = 0; i < numSamples; ++i)
+            data[i] = amplitude * (Type) (random.nextDouble() * 2.0 - 1.0);
+    }
+
+    /** Keeps the compiler from optimising away a result that is otherwise unused */
+    template <typename Type>
+    void doNotOptimise (const Type& value)
+    {
+        static volatile Type sink;
+        sink = value;
+        (void) sink;
+    }
+
+    inline void printTitle (const char* title)
+    {
+        std::printf ("\n== %s ==\n", title);
+    }
+}
@@ -0,0 +1,147 @@
+/*
+  ==============================================================================
+
+    PartitionedConvolution against juce::dsp::Convolution with a one second
+    impulse response at 32-sample blocks: the mean, 99.9th percentile and worst
+    time of a block, paced like an audio device so the background thread gets
+    the time it would get in a real session.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "BenchmarkUtilities.h"
+
+//==============================================================================
+namespace ConvolutionBenchmark
+{
+    constexpr int blockSize = 32;
+    constexpr double sampleRate = 48000.0;
+    constexpr int impulseResponseLength = 48000;
+    constexpr int numBlocks = (int) (4.0 * sampleRate) / blockSize;
+
+    /** Stereo noise decaying by 60 dB over the length, like a small room */
+    inline juce::AudioBuffer<float> makeImpulseResponse()
+    {
+        juce::AudioBuffer<float> ir (2, impulseResponseLength);
+
+        for (int ch = 0; ch < 2; ++ch)
+        {
+            auto* taps = ir.getWritePointer (ch);
+            BenchmarkUtilities::fillWithNoise (taps, (size_t) impulseResponseLength, 1.0f, (juce::uint32) ch + 1);
+
+            for (int i = 0; i < impulseResponseLength; ++i)
+                taps[i] *= std::pow (10.0f, -3.0f * (float) i / (float) impulseResponseLength);
+        }
+
+        return ir;
+    }
+
+    /** Processes numBlocks blocks of noise, one every blockSize / sampleRate seconds, and
+        returns the time of each block in nanoseconds.
+    */
+    template <typename Convolution>
+    std::vector<double> measureBlocks (Convolution& convolution)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        juce::ScopedNoDenormals noDenormals;
+
+        juce::AudioBuffer<float> source (2, blockSize), buffer (2, blockSize);
+
+        for (int ch = 0; ch < 2; ++ch)
+            BenchmarkUtilities::fillWithNoise (source.getWritePointer (ch), (size_t) blockSize, 0.5f, (juce::uint32) ch + 1);
+
+        std::vector<double> times;
+        times.reserve ((size_t) numBlocks);
+
+        auto blockDuration = std::chrono::duration_cast<Clock::duration> (std::chrono::duration<double> (blockSize / sampleRate));
+        auto deadline = Clock::now();
+
+        for (int i = 0; i < numBlocks; ++i)
+        {
+            buffer.makeCopyOf (source, true);
+            juce::dsp::AudioBlock<float> block (buffer);
+
+            auto start = Clock::now();
+            convolution.process (juce::dsp::ProcessContextReplacing<float> (block));
+            times.push_back (std::chrono::duration<double, std::nano> (Clock::now() - start).count());
+
+            BenchmarkUtilities::doNotOptimise (buffer.getSample (0, 0));
+
+            deadline += blockDuration;
+            std::this_thread::sleep_until (deadline);
+        }
+
+        return times;
+    }
+
+    inline void print (const char* name, std::vector<double> times)
+    {
+        auto budget = 1.0e9 * blockSize / sampleRate;
+        auto mean = std::accumulate (times.begin(), times.end(), 0.0) / (double) times.size();
+        std::sort (times.begin(), times.end());
+
+        std::printf ("%-22s mean %7.2f us, 99.9%% %8.2f us, worst %8.2f us (%5.1f%% of the block)\n",
+                     name, mean / 1000.0, times[times.size() * 999 / 1000] / 1000.0,
+                     times.back() / 1000.0, 100.0 * times.back() / budget);
+    }
+
+    /** juce::dsp::Convolution loads on its own thread and swaps the impulse response in while processing */
+    inline void waitUntilLoaded (juce::dsp::Convolution& convolution)
+    {
+        juce::AudioBuffer<float> buffer (2, blockSize);
+
+        for (int i = 0; i < 5000 && convolution.getCurrentIRSize() != impulseResponseLength; ++i)
+        {
+            buffer.clear();
+            juce::dsp::AudioBlock<float> block (buffer);
+            convolution.process (juce::dsp::ProcessContextReplacing<float> (block));
+            juce::Thread::sleep (1);
+        }
+
+        //読み込み後のクロスフェードが終わるまで回しておく
+        for (int i = 0; i < (int) sampleRate / blockSize; ++i)
+        {
+            juce::dsp::AudioBlock<float> block (buffer);
+            convolution.process (juce::dsp::ProcessContextReplacing<float> (block));
+        }
+    }
+
+    inline void measureJuceConvolution (const char* name, juce::dsp::Convolution& convolution)
+    {
+        convolution.prepare ({ sampleRate, (juce::uint32) blockSize, 2 });
+        convolution.loadImpulseResponse (makeImpulseResponse(), sampleRate,
+                                         juce::dsp::Convolution::Stereo::yes,
+                                         juce::dsp::Convolution::Trim::no,
+                                         juce::dsp::Convolution::Normalise::yes);
+        waitUntilLoaded (convolution);
+
+        print (name, measureBlocks (convolution));
+    }
+
+    inline void run()
+    {
+        BenchmarkUtilities::printTitle ("convolution: per-block time at 32-sample blocks");
+        std::printf ("stereo, %d-tap impulse response, block %d, 48 kHz, %.1f us per block\n",
+                     impulseResponseLength, blockSize, 1.0e6 * blockSize / sampleRate);
+
+        {
+            juce::dsp::Convolution convolution;
+            measureJuceConvolution ("juce uniform", convolution);
+        }
+
+        {
+            juce::dsp::Convolution convolution (juce::dsp::Convolution::NonUniform { 64 });
+            measureJuceConvolution ("juce non-uniform 64", convolution);
+        }
+
+        PartitionedConvolution convolution;
+        convolution.loadImpulseResponse (makeImpulseResponse(), sampleRate);
+        convolution.prepare ({ sampleRate, (juce::uint32) blockSize, 2 });
+
+        print ("partitioned 64 / 1024", measureBlocks (convolution));
+        std::printf ("tail partitions missed: %d\n", convolution.getNumMissedTailPartitions());
+    }
+}
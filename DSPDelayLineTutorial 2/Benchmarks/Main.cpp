@@ -0,0 +1,73 @@
+/*
+  ==============================================================================
+
+    Console benchmarks for the DSP classes of the tutorial. See CMakeLists.txt
+    for how to build and run them.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../Source/DSPDelayLineTutorial_01.h"
+
+#include "AdaaBenchmark.h"
+#include "ConvolutionBenchmark.h"
+#include "MidiDensityBenchmark.h"
+#include "OversamplingBenchmark.h"
+#include "TanhBenchmark.h"
+#include "VoiceRenderingBenchmark.h"
+
+//==============================================================================
+namespace
+{
+    struct Benchmark
+    {
+        const char* name;
+        void (*run)();
+    };
+
+    const Benchmark benchmarks[] =
+    {
+        { "tanh",         TanhBenchmark::run },
+        { "voices",       VoiceRenderingBenchmark::run },
+        { "midi",         MidiDensityBenchmark::run },
+        { "oversampling", OversamplingBenchmark::run },
+        { "adaa",         AdaaBenchmark::run },
+        { "convolution",  ConvolutionBenchmark::run }
+    };
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    auto numRun = 0;
+
+    for (auto& benchmark : benchmarks)
+    {
+        auto selected = (argc <= 1);
+
+        for (int i = 1; i < argc; ++i)
+            selected = selected || juce::String (argv[i]) == benchmark.name;
+
+        if (selected)
+        {
+            benchmark.run();
+            ++numRun;
+        }
+    }
+
+    if (numRun == 0)
+    {
+        std::printf ("Benchmarks:");
+
+        for (auto& benchmark : benchmarks)
+            std::printf (" %s", benchmark.name);
+
+        std::printf ("\n");
+        return 1;
+    }
+
+    return 0;
+}
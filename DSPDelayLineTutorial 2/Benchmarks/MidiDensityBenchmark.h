@@ -0,0 +1,101 @@
+/*
+  ==============================================================================
+
+    Cost of a host block against the number of MIDI events in it. AudioEngine
+    runs the FX chain once per host block; the per-sub-block variant calls it on
+    every piece that MPESynthesiser would split the block into, which is what
+    the engine used to do.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "BenchmarkUtilities.h"
+
+//==============================================================================
+namespace MidiDensityBenchmark
+{
+    constexpr int blockSize = 512;
+
+    /** numEvents note-ons and note-offs, spread evenly over the block and paired up, so
+        that the same buffer can be played every block
+    */
+    inline juce::MidiBuffer makeEvents (int numEvents)
+    {
+        juce::MidiBuffer midi;
+
+        for (int i = 0; i < numEvents; ++i)
+        {
+            auto note = 48 + (i / 2) % 12;
+            auto position = i * blockSize / juce::jmax (1, numEvents);
+
+            midi.addEvent (i % 2 == 0 ? juce::MidiMessage::noteOn (1, note, 0.8f)
+                                      : juce::MidiMessage::noteOff (1, note), position);
+        }
+
+        return midi;
+    }
+
+    /** Where MPESynthesiser splits the block: at every event, but never less than
+        its default minimum sub-block size (32) after the previous split
+    */
+    inline std::vector<int> getSubBlockStarts (const juce::MidiBuffer& midi)
+    {
+        std::vector<int> starts { 0 };
+
+        for (const auto metadata : midi)
+            if (metadata.samplePosition >= starts.back() + 32)
+                starts.push_back (metadata.samplePosition);
+
+        starts.push_back (blockSize);
+        return starts;
+    }
+
+    inline double measure (int numEvents, bool fxPerSubBlock)
+    {
+        juce::ScopedNoDenormals noDenormals;
+
+        AudioEngine engine (8);
+        engine.enableLegacyMode();
+        engine.prepare ({ 48000.0, (juce::uint32) blockSize, 2 });
+
+        juce::AudioBuffer<float> buffer (2, blockSize);
+        auto midi = makeEvents (numEvents);
+        auto starts = getSubBlockStarts (midi);
+
+        return BenchmarkUtilities::measureMedianNanoseconds (300, [&]
+        {
+            buffer.clear();
+
+            if (fxPerSubBlock)
+            {
+                //サブブロックごとに renderNextBlock を呼ぶと、FXもサブブロックごとに回る（以前の動作）
+                for (size_t i = 0; i + 1 < starts.size(); ++i)
+                    engine.renderNextBlock (buffer, midi, starts[i], starts[i + 1] - starts[i]);
+            }
+            else
+            {
+                engine.renderNextBlock (buffer, midi, 0, blockSize);
+            }
+
+            BenchmarkUtilities::doNotOptimise (buffer.getSample (0, 0));
+        });
+    }
+
+    inline void run()
+    {
+        BenchmarkUtilities::printTitle ("MIDI density: FX once per host block vs once per sub-block");
+        std::printf ("block %d, 48 kHz, 8 voices\n", blockSize);
+
+        for (auto numEvents : { 0, 2, 8, 16, 32, 64 })
+        {
+            auto perSubBlock = measure (numEvents, true);
+            auto perBlock = measure (numEvents, false);
+            auto numSubBlocks = (int) getSubBlockStarts (makeEvents (numEvents)).size() - 1;
+
+            std::printf ("%2d events (%2d sub-blocks): per sub-block %8.1f us, per host block %8.1f us, %.2fx\n",
+                         numEvents, numSubBlocks, perSubBlock * 1.0e-3, perBlock * 1.0e-3, perSubBlock / perBlock);
+        }
+    }
+}
@@ -0,0 +1,66 @@
+/*
+  ==============================================================================
+
+    Distortion with its waveshaper oversampled 1x to 8x, with either filter
+    type: time per sample at the base rate and the latency it reports.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "BenchmarkUtilities.h"
+
+//==============================================================================
+namespace OversamplingBenchmark
+{
+    using Filter = Distortion<float>::OversamplingFilter;
+
+    constexpr int blockSize = 512;
+    constexpr double sampleRate = 48000.0;
+
+    /** Median time of one stereo block in nanoseconds; latency is set to the reported latency */
+    inline double measure (size_t factorLog2, Filter filterType, float& latency)
+    {
+        juce::ScopedNoDenormals noDenormals;
+
+        Distortion<float> distortion;
+        distortion.setOversampling (factorLog2, filterType);
+        distortion.prepare ({ sampleRate, (juce::uint32) blockSize, 2 });
+        latency = distortion.getLatencyInSamples();
+
+        juce::AudioBuffer<float> source (2, blockSize), buffer (2, blockSize);
+
+        for (int ch = 0; ch < 2; ++ch)
+            BenchmarkUtilities::fillWithNoise (source.getWritePointer (ch), (size_t) blockSize, 0.5f, (juce::uint32) ch + 1);
+
+        return BenchmarkUtilities::measureMedianNanoseconds (500, [&]
+        {
+            buffer.makeCopyOf (source, true);
+            juce::dsp::AudioBlock<float> block (buffer);
+            distortion.process (juce::dsp::ProcessContextReplacing<float> (block));
+            BenchmarkUtilities::doNotOptimise (buffer.getSample (0, 0));
+        });
+    }
+
+    inline void run()
+    {
+        BenchmarkUtilities::printTitle ("oversampling: Distortion cost per factor");
+        std::printf ("stereo, block %d, 48 kHz\n", blockSize);
+
+        float latency = 0.0f;
+        auto base = measure (0, Filter::polyphaseIIR, latency);
+
+        for (auto filterType : { Filter::polyphaseIIR, Filter::equirippleFIR })
+        {
+            for (size_t factorLog2 = 0; factorLog2 <= 3; ++factorLog2)
+            {
+                auto time = factorLog2 == 0 ? base : measure (factorLog2, filterType, latency);
+
+                std::printf ("%-4s %dx: %6.2f ns/sample, %5.2fx the cost of 1x, latency %5.1f samples\n",
+                             filterType == Filter::polyphaseIIR ? "IIR" : "FIR", 1 << factorLog2,
+                             time / (2.0 * blockSize), time / base, factorLog2 == 0 ? 0.0 : (double) latency);
+            }
+        }
+    }
+}
@@ -0,0 +1,76 @@
+/*
+  ==============================================================================
+
+    FastTanh against std::tanh (ExactTanh): worst-case error over the range the
+    FX chain drives it with, and throughput of the block process() used by
+    Delay and Distortion.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "BenchmarkUtilities.h"
+
+//==============================================================================
+namespace TanhBenchmark
+{
+    template <typename Type>
+    void measureAccuracy (const char* typeName)
+    {
+        auto maxError = 0.0;
+        auto worstInput = 0.0;
+
+        //Distortion のプリゲイン (+30 dB) を掛けた後の範囲を細かく調べる
+        for (int i = -40000; i <= 40000; ++i)
+        {
+            auto x = (Type) i * Type (1.0e-4) * Type (4);
+            auto error = std::abs ((double) FastTanh<Type>::processSample (x) - std::tanh ((double) x));
+
+            if (error > maxError)
+            {
+                maxError = error;
+                worstInput = (double) x;
+            }
+        }
+
+        std::printf ("%-6s max |FastTanh - tanh| = %.3g (at x = %.4f)\n", typeName, maxError, worstInput);
+    }
+
+    template <typename Type>
+    void measureThroughput (const char* typeName)
+    {
+        constexpr size_t blockSize = 4096;
+        constexpr int numRuns = 200;
+
+        std::vector<Type> source (blockSize), data (blockSize);
+        BenchmarkUtilities::fillWithNoise (source.data(), blockSize, Type (8));
+
+        auto exact = BenchmarkUtilities::measureMedianNanoseconds (numRuns, [&]
+        {
+            std::copy (source.begin(), source.end(), data.begin());
+            ExactTanh<Type>::process (data.data(), blockSize);
+            BenchmarkUtilities::doNotOptimise (data[blockSize / 2]);
+        });
+
+        auto fast = BenchmarkUtilities::measureMedianNanoseconds (numRuns, [&]
+        {
+            std::copy (source.begin(), source.end(), data.begin());
+            FastTanh<Type>::process (data.data(), blockSize);
+            BenchmarkUtilities::doNotOptimise (data[blockSize / 2]);
+        });
+
+        std::printf ("%-6s std::tanh %6.2f ns/sample, FastTanh %6.2f ns/sample, %.1fx faster\n",
+                     typeName, exact / blockSize, fast / blockSize, exact / fast);
+    }
+
+    inline void run()
+    {
+        BenchmarkUtilities::printTitle ("tanh: FastTanh vs std::tanh");
+
+        measureAccuracy<float> ("float");
+        measureAccuracy<double> ("double");
+        measureThroughput<float> ("float");
+        measureThroughput<double> ("double");
+    }
+}
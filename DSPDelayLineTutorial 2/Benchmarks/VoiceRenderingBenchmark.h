@@ -0,0 +1,70 @@
+/*
+  ==============================================================================
+
+    AudioEngine with its voices rendered by ParallelVoiceRenderer: time per block
+    with 0 to 3 worker threads besides the audio thread, and the speedup over
+    rendering every voice on the audio thread. The FX chain always runs on the
+    audio thread, so it is part of every measurement.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "BenchmarkUtilities.h"
+
+//==============================================================================
+namespace VoiceRenderingBenchmark
+{
+    /** Median time of one block with numVoices notes held */
+    inline double measureBlockNanoseconds (size_t numRenderThreads, size_t numVoices, int blockSize)
+    {
+        //弦は数秒で減衰するので、鳴り終わる前に測り終える
+        constexpr int numBlocks = 150;
+
+        juce::ScopedNoDenormals noDenormals;
+
+        AudioEngine engine (numVoices);
+        engine.enableLegacyMode();
+        engine.setNumRenderThreads (numRenderThreads);
+        engine.prepare ({ 48000.0, (juce::uint32) blockSize, 2 });
+
+        juce::AudioBuffer<float> buffer (2, blockSize);
+        juce::MidiBuffer noteOns, noMidi;
+
+        for (int i = 0; i < (int) numVoices; ++i)
+            noteOns.addEvent (juce::MidiMessage::noteOn (1, 36 + i, 0.8f), 0);
+
+        buffer.clear();
+        engine.renderNextBlock (buffer, noteOns, 0, blockSize);
+
+        return BenchmarkUtilities::measureMedianNanoseconds (numBlocks, [&]
+        {
+            buffer.clear();
+            engine.renderNextBlock (buffer, noMidi, 0, blockSize);
+            BenchmarkUtilities::doNotOptimise (buffer.getSample (0, 0));
+        });
+    }
+
+    inline void run()
+    {
+        BenchmarkUtilities::printTitle ("voice rendering: worker threads vs audio thread only");
+
+        constexpr size_t numVoices = 32;
+        std::printf ("%d cores, %d voices held, 48 kHz\n", juce::SystemStats::getNumCpus(), (int) numVoices);
+
+        for (auto blockSize : { 64, 256 })
+        {
+            auto serial = measureBlockNanoseconds (0, numVoices, blockSize);
+            auto budget = 1.0e9 * blockSize / 48000.0;
+
+            for (size_t numThreads = 0; numThreads <= 3; ++numThreads)
+            {
+                auto time = numThreads == 0 ? serial : measureBlockNanoseconds (numThreads, numVoices, blockSize);
+
+                std::printf ("block %3d, %d workers: %8.1f us per block (%5.1f%% of real time), %.2fx\n",
+                             blockSize, (int) numThreads, time * 1.0e-3, 100.0 * time / budget, serial / time);
+            }
+        }
+    }
+}
@@ -0,0 +1,246 @@
+"""Generates Source/CabImpulseResponses.cpp and .h from Resources/guitar_amp.wav.
+
+Like BinaryData, the data goes in a .cpp that is compiled once, and the header
+only declares it. It holds the impulse response already resampled, normalised,
+cut into partitions and transformed for PartitionedConvolution at the common
+sample rates, plus the original 16-bit samples for any other rate. CabSimulator
+can then be created without touching the file system or running an FFT.
+
+resample() is the same Kaiser-windowed sinc as PartitionedConvolution::resample(),
+which handles the other rates at run time, so every rate gets the same filter.
+
+Run it again after changing the WAV, PartitionedConvolution's partition sizes or
+the resampler:
+
+    python3 Resources/make_cab_impulse_responses.py
+
+Only the Python standard library is needed.
+"""
+
+import cmath
+import math
+import os
+import struct
+import wave
+
+HEAD_SIZE = 64      # PartitionedConvolution::defaultHeadSize
+TAIL_SIZE = 1024    # PartitionedConvolution::defaultTailSize
+SAMPLE_RATES = (44100, 48000)
+RESAMPLER_ZERO_CROSSINGS = 32
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SOURCE_WAV = os.path.join(ROOT, "Resources", "guitar_amp.wav")
+OUTPUT_HEADER = os.path.join(ROOT, "Source", "CabImpulseResponses.h")
+OUTPUT_SOURCE = os.path.join(ROOT, "Source", "CabImpulseResponses.cpp")
+
+
+def read_wav(path):
+    with wave.open(path, "rb") as w:
+        assert w.getsampwidth() == 2, "only 16-bit WAV files are supported"
+        num_channels = w.getnchannels()
+        num_frames = w.getnframes()
+        data = struct.unpack("<%dh" % (num_frames * num_channels), w.readframes(num_frames))
+        return w.getframerate(), [list(data[ch::num_channels]) for ch in range(num_channels)]
+
+
+def bessel_i0(x):
+    total, term, k = 1.0, 1.0, 1
+    while term > 1e-12 * total:
+        term *= (x / (2.0 * k)) ** 2
+        total += term
+        k += 1
+    return total
+
+
+def resample(samples, source_rate, target_rate):
+    """Kaiser-windowed sinc interpolation, low-passed below the lower Nyquist frequency.
+
+    Keep this in step with PartitionedConvolution::resample().
+    """
+    if source_rate == target_rate:
+        return list(samples)
+
+    ratio = source_rate / target_rate
+    cutoff = min(1.0, 1.0 / ratio)
+    half_width = RESAMPLER_ZERO_CROSSINGS / cutoff
+    beta = 8.6
+    norm = bessel_i0(beta)
+    length = int(round(len(samples) / ratio))
+    result = []
+
+    for n in range(length):
+        centre = n * ratio
+        first = max(0, int(math.ceil(centre - half_width)))
+        last = min(len(samples) - 1, int(math.floor(centre + half_width)))
+        total = 0.0
+
+        for k in range(first, last + 1):
+            t = k - centre
+            window = bessel_i0(beta * math.sqrt(max(0.0, 1.0 - (t / half_width) ** 2))) / norm
+            x = math.pi * t * cutoff
+            total += samples[k] * window * cutoff * (math.sin(x) / x if x != 0.0 else 1.0)
+
+        result.append(total)
+
+    return result
+
+
+def normalise(channels):
+    """Same as juce::dsp::Convolution: 0.125 / sqrt (largest per-channel energy)."""
+    energy = max(sum(v * v for v in ch) for ch in channels)
+    gain = 0.125 / math.sqrt(energy) if energy > 0.0 else 1.0
+    return [[v * gain for v in ch] for ch in channels]
+
+
+def fft(values):
+    """Forward complex FFT without scaling, like juce::dsp::FFT."""
+    n = len(values)
+    a = list(values)
+    j = 0
+
+    for i in range(1, n):
+        bit = n >> 1
+        while j & bit:
+            j ^= bit
+            bit >>= 1
+        j ^= bit
+        if i < j:
+            a[i], a[j] = a[j], a[i]
+
+    size = 2
+    while size <= n:
+        step = cmath.exp(-2j * math.pi / size)
+        for start in range(0, n, size):
+            w = 1.0
+            for k in range(size // 2):
+                u = a[start + k]
+                v = a[start + k + size // 2] * w
+                a[start + k] = u + v
+                a[start + k + size // 2] = u - v
+                w *= step
+        size <<= 1
+
+    return a
+
+
+def partition_spectra(taps, first_tap, end_tap, partition_size):
+    """Bins 0 .. partitionSize of each zero-padded partition, interleaved re/im."""
+    end_tap = min(end_tap, len(taps))
+    result = []
+
+    for start in range(first_tap, end_tap, partition_size):
+        block = taps[start:min(start + partition_size, end_tap)]
+        block = block + [0.0] * (2 * partition_size - len(block))
+        for b in fft(block)[:partition_size + 1]:
+            result += [b.real, b.imag]
+
+    return result
+
+
+def format_array(declaration, values, formatter, per_line=8, indent="    "):
+    lines = [indent + declaration + " =", indent + "{"]
+    for i in range(0, len(values), per_line):
+        lines.append(indent + "    " + ", ".join(formatter(v) for v in values[i:i + per_line]) + ",")
+    lines.append(indent + "};")
+    return lines
+
+
+def format_float(value):
+    text = "%.9g" % value
+    if "." not in text and "e" not in text:
+        text += ".0"
+    return text + "f"
+
+
+GENERATED_COMMENT = [
+    "/*",
+    "  ==============================================================================",
+    "",
+    "    Generated by Resources/make_cab_impulse_responses.py from Resources/guitar_amp.wav.",
+    "    Don't edit this file; change the script and run it again.",
+    "",
+    "  ==============================================================================",
+    "*/",
+    "",
+]
+
+
+def write_lines(path, lines):
+    with open(path, "w", newline="\r\n") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def main():
+    source_rate, channels = read_wav(SOURCE_WAV)
+    num_samples = len(channels[0])
+    header = GENERATED_COMMENT + [
+        "#pragma once",
+        "",
+        "namespace CabImpulseResponses",
+        "{",
+        "    constexpr int headSize = %d, tailSize = %d;" % (HEAD_SIZE, TAIL_SIZE),
+        "",
+        "    /** The original samples, for sample rates without prepared partitions. */",
+        "    constexpr double guitarAmpSampleRate = %d.0;" % source_rate,
+        "    constexpr int guitarAmpNumChannels = %d, guitarAmpNumSamples = %d;" % (len(channels), num_samples),
+        "    extern const short guitarAmpSamples[];",
+    ]
+    source = GENERATED_COMMENT + [
+        '#include "CabImpulseResponses.h"',
+        "",
+        "namespace CabImpulseResponses",
+        "{",
+    ]
+    interleaved = [channels[ch][i] for ch in range(len(channels)) for i in range(num_samples)]
+    source += format_array("const short guitarAmpSamples[]", interleaved, str, 16)
+
+    for rate in SAMPLE_RATES:
+        source_channels = [[v / 32768.0 for v in ch] for ch in channels]
+        taps = normalise([resample(ch, source_rate, rate) for ch in source_channels])
+        direct, head, tail = [], [], []
+
+        for ch in taps:
+            direct += (ch + [0.0] * HEAD_SIZE)[:HEAD_SIZE]
+            head += partition_spectra(ch, HEAD_SIZE, 2 * TAIL_SIZE, HEAD_SIZE)
+            tail += partition_spectra(ch, 2 * TAIL_SIZE, len(ch), TAIL_SIZE)
+
+        num_head = len(head) // (len(taps) * 2 * (HEAD_SIZE + 1))
+        num_tail = len(tail) // (len(taps) * 2 * (TAIL_SIZE + 1))
+
+        header += [
+            "",
+            "    //==============================================================================",
+            "    namespace GuitarAmp%d" % rate,
+            "    {",
+            "        constexpr double sampleRate = %d.0;" % rate,
+            "        constexpr int numChannels = %d, numHeadPartitions = %d, numTailPartitions = %d;" % (len(taps), num_head, num_tail),
+            "",
+            "        /** The first headSize taps of each channel, then the interleaved re/im bins",
+            "            0 .. partitionSize of every partition of each channel. */",
+            "        extern const float directTaps[];",
+            "        extern const float headSpectra[];",
+            "        extern const float tailSpectra[];",
+            "    }",
+        ]
+        source += [
+            "",
+            "    //==============================================================================",
+            "    namespace GuitarAmp%d" % rate,
+            "    {",
+        ]
+        source += format_array("const float directTaps[]", direct, format_float, indent="        ")
+        source.append("")
+        source += format_array("const float headSpectra[]", head or [0.0], format_float, indent="        ")
+        source.append("")
+        source += format_array("const float tailSpectra[]", tail or [0.0], format_float, indent="        ")
+        source.append("    }")
+
+    header.append("}")
+    source.append("}")
+
+    write_lines(OUTPUT_HEADER, header)
+    write_lines(OUTPUT_SOURCE, source)
+
+
+if __name__ == "__main__":
+    main()
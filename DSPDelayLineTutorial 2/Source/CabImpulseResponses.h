@@ -0,0 +1,46 @@
+/*
+  ==============================================================================
+
+    Generated by Resources/make_cab_impulse_responses.py from Resources/guitar_amp.wav.
+    Don't edit this file; change the script and run it again.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+namespace CabImpulseResponses
+{
+    constexpr int headSize = 64, tailSize = 1024;
+
+    /** The original samples, for sample rates without prepared partitions. */
+    constexpr double guitarAmpSampleRate = 44100.0;
+    constexpr int guitarAmpNumChannels = 1, guitarAmpNumSamples = 45101;
+    extern const short guitarAmpSamples[];
+
+    //==============================================================================
+    namespace GuitarAmp44100
+    {
+        constexpr double sampleRate = 44100.0;
+        constexpr int numChannels = 1, numHeadPartitions = 31, numTailPartitions = 43;
+
+        /** The first headSize taps of each channel, then the interleaved re/im bins
+            0 .. partitionSize of every partition of each channel. */
+        extern const float directTaps[];
+        extern const float headSpectra[];
+        extern const float tailSpectra[];
+    }
+
+    //==============================================================================
+    namespace GuitarAmp48000
+    {
+        constexpr double sampleRate = 48000.0;
+        constexpr int numChannels = 1, numHeadPartitions = 31, numTailPartitions = 46;
+
+        /** The first headSize taps of each channel, then the interleaved re/im bins
+            0 .. partitionSize of every partition of each channel. */
+        extern const float directTaps[];
+        extern const float headSpectra[];
+        extern const float tailSpectra[];
+    }
+}
@@ -47,6 +47,10 @@
 
 #pragma once
 
+#include "../../Shared/Wavetables.h"
+#include "../../Shared/VoiceRendering.h"
+#include "CabImpulseResponses.h"
+
 //==============================================================================
 template <typename Type>
 class CustomOscillator
@@ -63,34 +67,13 @@ public:
     }
 
     //==============================================================================
-    enum class Waveform
-    {
-        sine,
-        saw
-    };
+    using Waveform = typename WavetableCache<Type>::Waveform;
 
     void setWaveform (Waveform waveform)
     {
-        switch (waveform)
-        {
-        case Waveform::sine:
-            processorChain.template get<oscIndex>().initialise ([] (Type x)
-            {
-                return std::sin (x);
-            }, 128);
-            break;
-
-        case Waveform::saw:
-            processorChain.template get<oscIndex>().initialise ([] (Type x)
-            {
-                return juce::jmap (x, Type (-juce::double_Pi), Type (juce::double_Pi), Type (-1), Type (1));
-            }, 128);
-            break;
-
-        default:
-            jassertfalse;
-            break;
-        }
+        //テーブルはボイス間、プラグインのインスタンス間で共有していて、ここでは受け取るだけ
+        wavetable = wavetableCache->getWavetable (waveform);
+        processorChain.template get<oscIndex>().setWavetable (wavetable.get());
     }
 
     //==============================================================================
@@ -109,29 +92,49 @@ public:
         processorChain.reset();
     }
 
+    /** False once the level has ramped down to zero; process() then only passes the input through */
+    bool isActive() const noexcept
+    {
+        auto& gain = processorChain.template get<gainIndex>();
+        return gain.isSmoothing() || gain.getGainLinear() != Type (0);
+    }
+
     //==============================================================================
     template <typename ProcessContext>
     void process (const ProcessContext& context) noexcept
     {
         auto&& outBlock = context.getOutputBlock();
+
+        if (context.usesSeparateInputAndOutputBlocks())
+            outBlock.copyFrom (context.getInputBlock());
+
+        //音量が0に落ち着いていたら、オシレーターもゲインも計算しない
+        if (! isActive())
+            return;
+
+        //オシレーターは入力に足すので、空のブロックに書かせる
         auto blockToUse = tempBlock.getSubBlock (0, outBlock.getNumSamples());
-        juce::dsp::ProcessContextReplacing<float> tempContext (blockToUse);
+        blockToUse.clear();
+        juce::dsp::ProcessContextReplacing<Type> tempContext (blockToUse);
         processorChain.process (tempContext);
 
-        outBlock.copyFrom (context.getInputBlock()).add (blockToUse);
+        outBlock.add (blockToUse);
     }
 
     //==============================================================================
     void prepare (const juce::dsp::ProcessSpec& spec)
     {
-        tempBlock = juce::dsp::AudioBlock<float> (heapBlock, spec.numChannels, spec.maximumBlockSize);
+        tempBlock = juce::dsp::AudioBlock<Type> (heapBlock, spec.numChannels, spec.maximumBlockSize);
         processorChain.prepare (spec);
     }
 
 private:
     //==============================================================================
     juce::HeapBlock<char> heapBlock;
-    juce::dsp::AudioBlock<float> tempBlock;
+    juce::dsp::AudioBlock<Type> tempBlock;
+
+    juce::SharedResourcePointer<WavetableCache<Type>> wavetableCache;
+    std::shared_ptr<const BandLimitedWavetable<Type>> wavetable;
 
     enum
     {
@@ -139,559 +142,3358 @@ private:
         gainIndex,
     };
 
-    juce::dsp::ProcessorChain<juce::dsp::Oscillator<Type>, juce::dsp::Gain<Type>> processorChain;
+    juce::dsp::ProcessorChain<WavetableOscillator<Type>, juce::dsp::Gain<Type>> processorChain;
 };
 
 //==============================================================================
-template <typename Type>
-class CabSimulator
-{
-public:
-    //==============================================================================
-    CabSimulator()
-    {
-        auto dir = juce::File::getCurrentWorkingDirectory();
-
-        int numTries = 0;
+/** Zero-latency convolution for long impulse responses, using non-uniform partitions.
 
-        while (! dir.getChildFile ("Resources").exists() && numTries++ < 15)
-            dir = dir.getParentDirectory();
-
-        auto& convolution = processorChain.template get<convolutionIndex>();
+    The impulse response is cut into three parts:
+    - the first headSize taps are convolved directly, sample by sample,
+    - the taps up to 2 * tailSize are convolved with headSize partitions on the audio thread,
+    - the rest is convolved with tailSize partitions on a background thread.
 
-        convolution.loadImpulseResponse (dir.getChildFile ("Resources").getChildFile ("guitar_amp.wav"),
-                                         juce::dsp::Convolution::Stereo::yes,
-                                         juce::dsp::Convolution::Trim::no,
-                                         1024);
-    }
+    Each part begins at a tap where its own partition latency is already covered, so the
+    output lines up with the impulse response sample for sample. The audio thread never
+    does more than one small FFT per channel per headSize samples. A tail partition is
+    handed to the background thread a whole tailSize before its output is needed, so
+    the big FFTs aren't computed inside a single audio block.
 
-    //==============================================================================
-    void prepare (const juce::dsp::ProcessSpec& spec)
-    {
-        processorChain.prepare (spec);
-    }
+    The audio thread never waits for or wakes the background thread. If a tail partition
+    isn't finished in time, its tailSize samples of tail output are left silent instead;
+    getNumMissedTailPartitions() counts how often that happened.
 
+    Only float is supported, like juce::dsp::Convolution.
+*/
+class PartitionedConvolution
+{
+public:
     //==============================================================================
-    template <typename ProcessContext>
-    void process (const ProcessContext& context) noexcept
+    ~PartitionedConvolution()
     {
-        processorChain.process (context);
+        stopTailThread();
     }
 
-    //==============================================================================
-    void reset() noexcept
+    /** Sets the impulse response. It is resampled to the processing sample rate and
+        normalised the same way as juce::dsp::Convolution does; call prepare() afterwards.
+    */
+    void loadImpulseResponse (juce::AudioBuffer<float>&& newImpulseResponse, double newImpulseResponseSampleRate)
     {
-        processorChain.reset();
+        impulseResponse = std::move (newImpulseResponse);
+        impulseResponseSampleRate = newImpulseResponseSampleRate;
     }
 
-private:
-    //==============================================================================
-    enum
+    /** An impulse response that has already been resampled, normalised, cut into partitions
+        and transformed for one sample rate, e.g. by a script at build time. The data isn't
+        copied, so it has to outlive the convolution.
+    */
+    struct PreparedImpulseResponse
     {
-        convolutionIndex
+        double sampleRate;
+        int headSize, tailSize, numChannels, numHeadPartitions, numTailPartitions;
+        const float* directTaps;    // headSize taps per channel
+        const float* headSpectra;   // numHeadPartitions * (headSize + 1) complex bins per channel
+        const float* tailSpectra;   // numTailPartitions * (tailSize + 1) complex bins per channel
     };
 
-    juce::dsp::ProcessorChain<juce::dsp::Convolution> processorChain;
-};
-
-//==============================================================================
-template <typename Type>
-class DelayLine
-{
-public:
-    void clear() noexcept
+    /** prepare() uses the one matching the sample rate and partition sizes, and only falls
+        back to the impulse response from loadImpulseResponse() when there is none.
+    */
+    void loadPreparedImpulseResponses (std::vector<PreparedImpulseResponse> newPreparedImpulseResponses)
     {
-        std::fill (rawData.begin(), rawData.end(), Type (0));
+        preparedImpulseResponses = std::move (newPreparedImpulseResponses);
     }
 
-    size_t size() const noexcept
+    bool hasPreparedImpulseResponse (double sampleRate) const noexcept
     {
-        return rawData.size();
+        return findPreparedImpulseResponse (sampleRate) != nullptr;
     }
 
-    void resize (size_t newValue)
+    /** Both sizes must be powers of two with tailSize > headSize. Call prepare() afterwards. */
+    void setPartitionSizes (int newHeadSize, int newTailSize)
     {
-        rawData.resize (newValue);
-        leastRecentIndex = 0;
-    }
+        jassert (juce::isPowerOfTwo (newHeadSize) && juce::isPowerOfTwo (newTailSize));
+        jassert (newTailSize > newHeadSize);
 
-    Type back() const noexcept
-    {
-        return rawData[leastRecentIndex];
+        headSize = newHeadSize;
+        tailSize = newTailSize;
     }
 
-    Type get (size_t delayInSamples) const noexcept
+    //==============================================================================
+    /** Builds the partitions and starts the background thread if the impulse response
+        has a tail. Call this from the message thread while nothing is processing.
+    */
+    void prepare (const juce::dsp::ProcessSpec& spec)
     {
-        jassert(delayInSamples >= 0 && delayInSamples < size());
-        
-        //最新のサンプル位置(leastRecentIndex+1)+何サンプル戻るか（delayInSamples）
-        return rawData[(leastRecentIndex+1+delayInSamples)%size()];
-    }
+        stopTailThread();
 
-    /** Set the specified sample in the delay line */
-    void set (size_t delayInSamples, Type newValue) noexcept
-    {
-        jassert(delayInSamples >= 0 && delayInSamples < size());
-        //特定の位置でサンプルを書き換え
-        rawData[(leastRecentIndex+1+delayInSamples)% size()] = newValue;
-    }
+        numChannels = (int) spec.numChannels;
+        directTaps.resize ((size_t) numChannels);
+        directHistory.resize ((size_t) numChannels);
 
-    /** Adds a new value to the delay line, overwriting the least recently added sample */
-    void push (Type valueToAdd) noexcept
-    {
-        //delay lineはleastRecentIndexが一番古いサンプル、そこから遡るごとに新しくなる
-        rawData[leastRecentIndex] = valueToAdd; //古いサンプルを書き換え
-        leastRecentIndex = leastRecentIndex == 0 ? size()-1: leastRecentIndex - 1 ; //一つ戻る
-    }
+        if (auto* prepared = findPreparedImpulseResponse (spec.sampleRate))
+        {
+            //変換済みのデータをそのまま指すだけなので、FFT もコピーもしない
+            for (int ch = 0; ch < numChannels; ++ch)
+                setDirectTaps (ch, prepared->directTaps + juce::jmin (ch, prepared->numChannels - 1) * headSize, headSize);
 
-private:
-    std::vector<Type> rawData;
-    size_t leastRecentIndex = 0;
-};
+            headStage.prepare (prepared->headSpectra, prepared->numChannels, numChannels, headSize, prepared->numHeadPartitions);
+            tailStage.prepare (prepared->tailSpectra, prepared->numChannels, numChannels, tailSize, prepared->numTailPartitions);
+        }
+        else
+        {
+            auto ir = getResampledImpulseResponse (spec.sampleRate);
+            auto irLength = ir.getNumSamples();
 
-//==============================================================================
-template <typename Type, size_t maxNumChannels = 2>
-class Delay
-{
-public:
-    //==============================================================================
-    Delay()
-    {
-        setMaxDelayTime(2.0f);
-        setDelayTime(0, 0.7f);
-        setDelayTime(1,0.5f);
-        setWetLevel(0.8f);
-        setFeedback(0.5f);
-    }
+            for (int ch = 0; ch < numChannels; ++ch)
+                setDirectTaps (ch, ir.getReadPointer (juce::jmin (ch, ir.getNumChannels() - 1)), juce::jmin (headSize, irLength));
 
-    //==============================================================================
-    void prepare (const juce::dsp::ProcessSpec& spec)
-    {
-        //満たさなければプログラムを停止 (jassert = juce + assert)
-        jassert(spec.numChannels <= maxNumChannels);
-        //Typeとつけるのは、クラスをtemplateにしてるから。Delayクラスを扱うときに、doubleでもfloatでも対応できるようにする
-        sampleRate = (Type) spec.sampleRate;
-        //secで指定したパラメータにサンプルレートをかけてサンプル時間にして保存
-        updateDelayLineSize();
-        updateDelayTime();
-        
-        //
-        lpFilterCoefs = juce::dsp::IIR::Coefficients<Type>::makeFirstOrderLowPass(sampleRate, Type(1e3));
-        
-        for (auto& f : lpFilters)
-        {
-            f.prepare(spec);
-            f.coefficients  = lpFilterCoefs;
+            headStage.prepare (ir, numChannels, headSize, headSize, 2 * tailSize);
+            tailStage.prepare (ir, numChannels, tailSize, 2 * tailSize, irLength);
         }
-    }
 
-    //==============================================================================
-    void reset() noexcept
-    {
-        //フィルターをリセット
-        for (auto& f: lpFilters)
-            f.reset();
-        //バッファをクリア
-        for (auto& dline : delayLines)
-            dline.clear();
-    }
+        for (auto& history : directHistory)
+            history.assign ((size_t) (2 * headSize), 0.0f);
 
-    //==============================================================================
-    size_t getNumChannels() const noexcept
-    {
-        return delayLines.size();
-    }
+        headInput.setSize (numChannels, headSize);
+        headOutput.setSize (numChannels, headSize);
+        tailInput.setSize (numChannels, tailSize);
 
-    //==============================================================================
-    void setMaxDelayTime (Type newValue)
-    {
-        //0より大きい
-        jassert(newValue > Type(0));
-        maxDelayTime = newValue;
-        //maxDelayTimeの長さにDelayLineのサンプル数を合わせる
-        updateDelayLineSize();
-    }
+        for (auto& input : tailJobInputs)
+            input.setSize (numChannels, tailSize);
 
-    //==============================================================================
-    void setFeedback (Type newValue) noexcept
-    {
-        jassert (newValue >= Type (0) && newValue <= Type (1));
-        feedback = newValue;
+        for (auto& output : tailJobOutputs)
+            output.setSize (numChannels, tailSize);
+
+        reset();
+
+        if (tailStage.numPartitions > 0)
+        {
+            tailThread = std::make_unique<TailThread> (*this);
+            tailThread->startThread (juce::Thread::realtimeAudioPriority);
+        }
     }
 
-    //==============================================================================
-    void setWetLevel (Type newValue) noexcept
+    /** How many tailSize stretches of output went without their tail because the background
+        thread fell behind, since the last prepare() or reset().
+    */
+    int getNumMissedTailPartitions() const noexcept
     {
-        jassert (newValue >= Type (0) && newValue <= Type (1));
-        wetLevel = newValue;
+        return numMissedTailPartitions.load (std::memory_order_relaxed);
     }
 
     //==============================================================================
-    void setDelayTime (size_t channel, Type newValue)
+    template <typename ProcessContext>
+    void process (const ProcessContext& context) noexcept
     {
-        if (channel>= getNumChannels())
+        static_assert (std::is_same<typename ProcessContext::SampleType, float>::value,
+                       "PartitionedConvolution only processes float");
+
+        auto&& inBlock  = context.getInputBlock();
+        auto&& outBlock = context.getOutputBlock();
+
+        if (context.isBypassed)
         {
-            jassertfalse;
+            if (context.usesSeparateInputAndOutputBlocks())
+                outBlock.copyFrom (inBlock);
+
             return;
         }
-        
-        jassert(newValue >= Type(0));
-        delayTimes[channel] = newValue;
-        
-        updateDelayTime();
-    }
 
-    //==============================================================================
-    template <typename ProcessContext>
-    void process (const ProcessContext& context) noexcept
-    {
-        //チャンネル数、サンプル数があっているか検査
-        auto& inputBlock = context.getInputBlock();
-        auto& outputBlock = context.getOutputBlock();
-        auto numSamples = outputBlock.getNumSamples();
-        auto numChannels = outputBlock.getNumChannels();
-        
-        jassert(inputBlock.getNumSamples() == numSamples);
-        jassert(inputBlock.getNumChannels() == numChannels);
-        
-        for (size_t ch = 0; ch< numChannels; ++ch)
+        auto numSamples = (int) outBlock.getNumSamples();
+        auto numChannelsToProcess = juce::jmin ((int) outBlock.getNumChannels(), numChannels);
+        auto hasTail = tailThread != nullptr;
+
+        //チャンクはヘッドの区切りをまたがない。テールの長さはヘッドの倍数なので、テールの区切りもまたがない
+        for (int start = 0; start < numSamples;)
         {
-            auto* input = inputBlock .getChannelPointer(ch);
-            auto* output = outputBlock .getChannelPointer(ch);
-            auto& dline = delayLines[ch];
-            auto delayTime = delayTimesSample[ch];
-            auto& filter = lpFilters[ch];
-            
-            for(size_t i=0; i<numSamples; ++i)
+            auto num = juce::jmin (numSamples - start, headSize - headPosition);
+
+            for (int ch = 0; ch < numChannelsToProcess; ++ch)
             {
-                //、delaytimeだけ手前のディレイのサンプルを取得
-                //auto delayedSample = dline.get(delayTime);
-                
-                //delaytimeだけ前のディレイのサンプルを取得、ただしLPFにかける
-                auto delayedSample = filter.processSample(dline.get(delayTime));
-                
-                //現在のサンプルを取得
-                auto inputSample = input[i];
-                //ディレイ信号とinput信号を混ぜ、tanhで変位を0~1に抑え、delaytime後に鳴るようにpush
-                auto dlineInputSample = std::tanh(inputSample+feedback*delayedSample);
-                dline.push(dlineInputSample);
-                //delay信号をwet率で混ぜる
-                auto outputSample = inputSample + wetLevel * delayedSample;
-                output[i] = outputSample;
+                auto* in  = inBlock.getChannelPointer ((size_t) ch) + start;
+                auto* out = outBlock.getChannelPointer ((size_t) ch) + start;
+                auto* headResult = headOutput.getReadPointer (ch, headPosition);
+                auto* tailResult = tailJobOutputs[(size_t) tailReadIndex].getReadPointer (ch, tailPosition);
+
+                juce::FloatVectorOperations::copy (headInput.getWritePointer (ch, headPosition), in, num);
+
+                if (hasTail)
+                    juce::FloatVectorOperations::copy (tailInput.getWritePointer (ch, tailPosition), in, num);
+
+                for (int i = 0; i < num; ++i)
+                    out[i] = processDirect (ch, headPosition + i, in[i]) + headResult[i] + tailResult[i];
             }
-        }
-    }
 
-private:
-    //==============================================================================
-    std::array<DelayLine<Type>, maxNumChannels> delayLines;
-    std::array<size_t, maxNumChannels> delayTimesSample;
-    std::array<Type, maxNumChannels> delayTimes;
-    Type feedback { Type (0) };
-    Type wetLevel { Type (0) };
+            start += num;
+            headPosition += num;
+            tailPosition += num;
 
-    std::array<juce::dsp::IIR::Filter<Type>, maxNumChannels> lpFilters;
-    typename juce::dsp::IIR::Coefficients<Type>::Ptr lpFilterCoefs;
-    
+            if (headPosition == headSize)
+            {
+                for (int ch = 0; ch < numChannelsToProcess; ++ch)
+                    headStage.processPartition (ch, headInput.getReadPointer (ch), headOutput.getWritePointer (ch));
 
-    Type sampleRate   { Type (44.1e3) };
-    Type maxDelayTime { Type (2) };
+                headPosition = 0;
+            }
 
-    //==============================================================================
-    //DelayLineのサンプル数を、Delayのテールの長さに合わせる
-    void updateDelayLineSize()
-    {
-        auto delayLineSizeSamples = (size_t) std::ceil(maxDelayTime*sampleRate);
-        
-        for (auto& dline : delayLines)
-            dline.resize(delayLineSizeSamples);
-    }
+            if (tailPosition == tailSize)
+            {
+                if (hasTail)
+                    startTailPartition();
 
-    //==============================================================================
-    void updateDelayTime() noexcept
-    {
-        for (size_t ch=0; ch< maxNumChannels; ++ch)
-            delayTimesSample[ch] = (size_t) juce::roundToInt(delayTimes[ch]*sampleRate);
+                tailPosition = 0;
+            }
+        }
+
+        for (auto ch = (size_t) numChannelsToProcess; ch < outBlock.getNumChannels(); ++ch)
+            outBlock.getSingleChannelBlock (ch).clear();
     }
-};
 
-//==============================================================================
-template <typename Type>
-class Distortion
-{
-public:
     //==============================================================================
-    Distortion()
+    /** Waits for the background thread to finish its queued tail partitions, so don't call
+        this from the audio thread.
+    */
+    void reset() noexcept
     {
-        auto& waveshaper = processorChain.template get<waveshaperIndex>();
-        waveshaper.functionToUse = [] (Type x)
-                                   {
-                                       return std::tanh (x);
-                                   };
+        waitForTailPartitions();
 
-        auto& preGain = processorChain.template get<preGainIndex>();
-        preGain.setGainDecibels (30.0f);
+        for (auto& history : directHistory)
+            std::fill (history.begin(), history.end(), 0.0f);
 
-        auto& postGain = processorChain.template get<postGainIndex>();
-        postGain.setGainDecibels (0.0f);
-    }
+        headStage.reset();
+        tailStage.reset();
 
-    //==============================================================================
-    void prepare (const juce::dsp::ProcessSpec& spec)
-    {
-        auto& filter = processorChain.template get<filterIndex>();
-        filter.state = FilterCoefs::makeFirstOrderHighPass (spec.sampleRate, 1000.0f);
+        headInput.clear();
+        headOutput.clear();
+        tailInput.clear();
 
-        processorChain.prepare (spec);
+        for (auto& output : tailJobOutputs)
+            output.clear();
+
+        headPosition = 0;
+        tailPosition = 0;
+        tailReadIndex = silentTailIndex;
+        hasTailJobToRead = false;
+        numMissedTailPartitions = 0;
     }
 
+private:
     //==============================================================================
-    template <typename ProcessContext>
-    void process (const ProcessContext& context) noexcept
+    /** Overlap-save convolution with equally sized partitions of one stretch of the impulse
+        response. Every call to processPartition() takes partitionSize new input samples and
+        returns the matching partitionSize output samples of that stretch, as if it started at tap 0.
+    */
+    struct UniformStage
     {
-        processorChain.process (context);
-    }
+        using Complex = juce::dsp::Complex<float>;
+
+        /** Transforms the partitions of taps firstTap .. endTap of ir. */
+        void prepare (const juce::AudioBuffer<float>& ir, int numChannelsToUse,
+                      int newPartitionSize, int firstTap, int endTap)
+        {
+            setSize (numChannelsToUse, newPartitionSize,
+                     juce::jmax (0, (juce::jmin (endTap, ir.getNumSamples()) - firstTap + newPartitionSize - 1) / newPartitionSize));
+
+            for (int ch = 0; ch < numChannelsToUse; ++ch)
+            {
+                auto& channel = channels[(size_t) ch];
+                auto* taps = ir.getReadPointer (juce::jmin (ch, ir.getNumChannels() - 1));
+
+                channel.ownedIrSpectra.resize ((size_t) numPartitions * numBins);
+                channel.irSpectra = channel.ownedIrSpectra.data();
+
+                for (int p = 0; p < numPartitions; ++p)
+                {
+                    auto first = firstTap + p * partitionSize;
+                    auto num = juce::jmin (partitionSize, ir.getNumSamples() - first);
+
+                    std::fill (fftBuffer.begin(), fftBuffer.end(), 0.0f);
+                    std::copy (taps + first, taps + first + num, fftBuffer.begin());
+                    fft->performRealOnlyForwardTransform (fftBuffer.data(), true);
+
+                    auto* spectrum = reinterpret_cast<const Complex*> (fftBuffer.data());
+                    std::copy (spectrum, spectrum + numBins, channel.ownedIrSpectra.begin() + (std::ptrdiff_t) ((size_t) p * numBins));
+                }
+            }
+
+            reset();
+        }
+
+        /** Uses partitions that were transformed ahead of time, without copying them. */
+        void prepare (const float* spectra, int numChannelsInSpectra, int numChannelsToUse,
+                      int newPartitionSize, int newNumPartitions)
+        {
+            setSize (numChannelsToUse, newPartitionSize, newNumPartitions);
+
+            for (int ch = 0; ch < numChannelsToUse; ++ch)
+            {
+                auto& channel = channels[(size_t) ch];
+                auto channelOffset = (size_t) juce::jmin (ch, numChannelsInSpectra - 1) * (size_t) numPartitions * numBins;
+
+                channel.ownedIrSpectra.clear();
+                channel.irSpectra = reinterpret_cast<const Complex*> (spectra) + channelOffset;
+            }
+
+            reset();
+        }
+
+        void setSize (int numChannelsToUse, int newPartitionSize, int newNumPartitions)
+        {
+            partitionSize = newPartitionSize;
+            numBins = (size_t) partitionSize + 1;
+            numPartitions = newNumPartitions;
+            fft = std::make_unique<juce::dsp::FFT> (juce::roundToInt (std::log2 (2 * partitionSize)));
+            fftBuffer.assign ((size_t) (4 * partitionSize), 0.0f);
+
+            channels.resize ((size_t) numChannelsToUse);
+
+            for (auto& channel : channels)
+            {
+                channel.inputSpectra.resize ((size_t) numPartitions * numBins);
+                channel.previousInput.resize ((size_t) partitionSize);
+            }
+        }
+
+        void reset() noexcept
+        {
+            for (auto& channel : channels)
+            {
+                std::fill (channel.inputSpectra.begin(), channel.inputSpectra.end(), Complex());
+                std::fill (channel.previousInput.begin(), channel.previousInput.end(), 0.0f);
+                channel.newestPartition = 0;
+            }
+        }
+
+        void processPartition (int ch, const float* input, float* output) noexcept
+        {
+            if (numPartitions == 0)
+            {
+                juce::FloatVectorOperations::clear (output, partitionSize);
+                return;
+            }
+
+            auto& channel = channels[(size_t) ch];
+            auto* buffer = fftBuffer.data();
+
+            //ひとつ前の区間と今の区間を並べて変換する
+            juce::FloatVectorOperations::copy (buffer, channel.previousInput.data(), partitionSize);
+            juce::FloatVectorOperations::copy (buffer + partitionSize, input, partitionSize);
+            juce::FloatVectorOperations::clear (buffer + 2 * partitionSize, 2 * partitionSize);
+            juce::FloatVectorOperations::copy (channel.previousInput.data(), input, partitionSize);
+
+            fft->performRealOnlyForwardTransform (buffer, true);
+
+            channel.newestPartition = (channel.newestPartition + 1) % numPartitions;
+            auto* spectrum = reinterpret_cast<Complex*> (buffer);
+            std::copy (spectrum, spectrum + numBins, channel.inputSpectra.begin() + (std::ptrdiff_t) ((size_t) channel.newestPartition * numBins));
+
+            std::fill (spectrum, spectrum + 2 * partitionSize, Complex());
+
+            //p 番目の区間の IR には p 区間前の入力を掛ける
+            for (int p = 0; p < numPartitions; ++p)
+            {
+                auto inputIndex = (channel.newestPartition - p + numPartitions) % numPartitions;
+                auto* x = channel.inputSpectra.data() + (size_t) inputIndex * numBins;
+                auto* h = channel.irSpectra + (size_t) p * numBins;
+
+                for (size_t i = 0; i < numBins; ++i)
+                    spectrum[i] += x[i] * h[i];
+            }
+
+            fft->performRealOnlyInverseTransform (buffer);
+
+            //後ろ半分だけが巡回の影響を受けない
+            juce::FloatVectorOperations::copy (output, buffer + partitionSize, partitionSize);
+        }
+
+        struct Channel
+        {
+            std::vector<Complex> ownedIrSpectra, inputSpectra;
+            const Complex* irSpectra = nullptr;
+            std::vector<float> previousInput;
+            int newestPartition = 0;
+        };
+
+        std::unique_ptr<juce::dsp::FFT> fft;
+        std::vector<float> fftBuffer;
+        std::vector<Channel> channels;
+        int partitionSize = 0, numPartitions = 0;
+        size_t numBins = 0;
+    };
+
+    //==============================================================================
+    struct TailThread  : public juce::Thread
+    {
+        TailThread (PartitionedConvolution& ownerToUse)
+            : juce::Thread ("Convolution tail"), owner (ownerToUse)
+        {}
+
+        //オーディオスレッドからは起こさないので、1msごとに見に行く。
+        //受け取った仕事は終了の前に片付けて、開始と完了の数を揃えてから抜ける
+        void run() override
+        {
+            for (;;)
+            {
+                if (owner.numTailPartitionsStarted.load (std::memory_order_acquire)
+                      != owner.numTailPartitionsDone.load (std::memory_order_relaxed))
+                {
+                    owner.processTailPartition();
+                    continue;
+                }
+
+                if (threadShouldExit())
+                    return;
+
+                wait (1);
+            }
+        }
+
+        PartitionedConvolution& owner;
+    };
+
+    //==============================================================================
+    static constexpr int defaultHeadSize = 64;
+    static constexpr int defaultTailSize = 1024;
+
+    juce::AudioBuffer<float> impulseResponse;
+    double impulseResponseSampleRate = 44100.0;
+    std::vector<PreparedImpulseResponse> preparedImpulseResponses;
+    int headSize = defaultHeadSize, tailSize = defaultTailSize;
+    int numChannels = 0;
+
+    std::vector<std::vector<float>> directTaps, directHistory;
+    UniformStage headStage, tailStage;
+    juce::AudioBuffer<float> headInput, headOutput, tailInput;
+
+    //テールの仕事の入出力のリング。最後の出力は書かれることのない無音で、間に合わなかった時に読む
+    static constexpr int numTailJobs = 4, silentTailIndex = numTailJobs;
+    std::array<juce::AudioBuffer<float>, numTailJobs> tailJobInputs;
+    std::array<juce::AudioBuffer<float>, numTailJobs + 1> tailJobOutputs;
+    int headPosition = 0, tailPosition = 0, tailReadIndex = silentTailIndex;
+    bool hasTailJobToRead = false;
+
+    std::unique_ptr<TailThread> tailThread;
+    std::atomic<juce::uint32> numTailPartitionsStarted { 0 }, numTailPartitionsDone { 0 };
+    std::atomic<int> numMissedTailPartitions { 0 };
+
+    //==============================================================================
+    const PreparedImpulseResponse* findPreparedImpulseResponse (double sampleRate) const noexcept
+    {
+        for (auto& prepared : preparedImpulseResponses)
+            if (prepared.sampleRate == sampleRate && prepared.headSize == headSize && prepared.tailSize == tailSize)
+                return &prepared;
+
+        return nullptr;
+    }
+
+    juce::AudioBuffer<float> getResampledImpulseResponse (double sampleRate) const
+    {
+        if (impulseResponse.getNumSamples() == 0 || impulseResponse.getNumChannels() == 0)
+        {
+            juce::AudioBuffer<float> silence (1, 1);
+            silence.clear();
+            return silence;
+        }
+
+        auto ir = sampleRate != impulseResponseSampleRate ? resample (impulseResponse, impulseResponseSampleRate, sampleRate)
+                                                          : impulseResponse;
+
+        //juce::dsp::Convolution と同じ正規化
+        auto maxSumOfSquares = 0.0f;
+
+        for (int ch = 0; ch < ir.getNumChannels(); ++ch)
+        {
+            auto sumOfSquares = 0.0f;
+
+            for (int i = 0; i < ir.getNumSamples(); ++i)
+                sumOfSquares += ir.getSample (ch, i) * ir.getSample (ch, i);
+
+            maxSumOfSquares = juce::jmax (maxSumOfSquares, sumOfSquares);
+        }
+
+        if (maxSumOfSquares > 0.0f)
+            ir.applyGain (0.125f / std::sqrt (maxSumOfSquares));
+
+        return ir;
+    }
+
+    /** Kaiser-windowed sinc interpolation, low-passed below the lower of the two Nyquist
+        frequencies. It is the same filter as resample() in Resources/make_cab_impulse_responses.py,
+        so impulse responses prepared by the script and those resampled here sound the same.
+    */
+    static juce::AudioBuffer<float> resample (const juce::AudioBuffer<float>& source, double sourceRate, double targetRate)
+    {
+        constexpr int numZeroCrossings = 32;
+        constexpr double beta = 8.6;
+
+        auto ratio = sourceRate / targetRate;
+        auto cutoff = juce::jmin (1.0, 1.0 / ratio);
+        auto halfWidth = numZeroCrossings / cutoff;
+        auto windowNorm = besselI0 (beta);
+        auto numSourceSamples = source.getNumSamples();
+
+        juce::AudioBuffer<float> result (source.getNumChannels(), juce::jmax (1, juce::roundToInt (numSourceSamples / ratio)));
+        std::vector<double> weights;
+
+        for (int n = 0; n < result.getNumSamples(); ++n)
+        {
+            auto centre = n * ratio;
+            auto first = juce::jmax (0, (int) std::ceil (centre - halfWidth));
+            auto last = juce::jmin (numSourceSamples - 1, (int) std::floor (centre + halfWidth));
+
+            //重みはチャンネルによらないので、一度だけ計算する
+            weights.clear();
+
+            for (int k = first; k <= last; ++k)
+            {
+                auto t = k - centre;
+                auto window = besselI0 (beta * std::sqrt (juce::jmax (0.0, 1.0 - (t / halfWidth) * (t / halfWidth)))) / windowNorm;
+                auto x = juce::MathConstants<double>::pi * t * cutoff;
+                weights.push_back (window * cutoff * (x != 0.0 ? std::sin (x) / x : 1.0));
+            }
+
+            for (int ch = 0; ch < source.getNumChannels(); ++ch)
+            {
+                auto* samples = source.getReadPointer (ch);
+                auto total = 0.0;
+
+                for (int k = first; k <= last; ++k)
+                    total += samples[k] * weights[(size_t) (k - first)];
+
+                result.setSample (ch, n, (float) total);
+            }
+        }
+
+        return result;
+    }
+
+    static double besselI0 (double x) noexcept
+    {
+        auto total = 1.0, term = 1.0;
+
+        for (int k = 1; term > 1e-12 * total; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            total += term;
+        }
+
+        return total;
+    }
+
+    void setDirectTaps (int ch, const float* taps, int numTaps)
+    {
+        //内積が前から取れるよう、逆順にしておく
+        auto& reversed = directTaps[(size_t) ch];
+        reversed.assign ((size_t) headSize, 0.0f);
+
+        for (int i = 0; i < numTaps; ++i)
+            reversed[(size_t) (headSize - 1 - i)] = taps[i];
+    }
+
+    /** position is where the sample lies within the current head partition. */
+    float processDirect (int ch, int position, float input) noexcept
+    {
+        auto& history = directHistory[(size_t) ch];
+
+        //二重に書いておけば、直近 headSize サンプルがいつも連続して読める
+        history[(size_t) position] = input;
+        history[(size_t) (position + headSize)] = input;
+
+        auto* window = history.data() + position + 1;
+        auto* taps = directTaps[(size_t) ch].data();
+        auto sum = 0.0f;
+
+        for (int i = 0; i < headSize; ++i)
+            sum += window[i] * taps[i];
+
+        return sum;
+    }
+
+    /** Called on the audio thread; never waits for the background thread. */
+    void startTailPartition() noexcept
+    {
+        auto started = numTailPartitionsStarted.load (std::memory_order_relaxed);
+        auto done = numTailPartitionsDone.load (std::memory_order_acquire);
+
+        //前の区切りで渡したテールの結果が次の tailSize サンプルの出力になる。間に合っていなければ待たずに無音にする
+        //それが最後に渡した仕事なので、開始と完了の数が揃っていれば終わっている
+        if (hasTailJobToRead && done == started)
+        {
+            tailReadIndex = (int) ((started - 1) % numTailJobs);
+        }
+        else
+        {
+            if (hasTailJobToRead)
+                numMissedTailPartitions.fetch_add (1, std::memory_order_relaxed);
+
+            tailReadIndex = silentTailIndex;
+        }
+
+        //リングが埋まっていたら、まだ読まれている入力を上書きしないよう、この区間のテールは諦める
+        hasTailJobToRead = started - done < (juce::uint32) numTailJobs;
+
+        if (! hasTailJobToRead)
+        {
+            numMissedTailPartitions.fetch_add (1, std::memory_order_relaxed);
+            return;
+        }
+
+        auto& input = tailJobInputs[(size_t) (started % numTailJobs)];
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            juce::FloatVectorOperations::copy (input.getWritePointer (ch), tailInput.getReadPointer (ch), tailSize);
+
+        numTailPartitionsStarted.store (started + 1, std::memory_order_release);
+    }
+
+    void waitForTailPartitions() const noexcept
+    {
+        //スレッドが止まっていれば、開始と完了の数は揃っている
+        while (tailThread != nullptr
+                && numTailPartitionsDone.load (std::memory_order_acquire)
+                     != numTailPartitionsStarted.load (std::memory_order_relaxed))
+            std::this_thread::yield();
+    }
+
+    void processTailPartition() noexcept
+    {
+        auto job = (size_t) (numTailPartitionsDone.load (std::memory_order_relaxed) % numTailJobs);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            tailStage.processPartition (ch, tailJobInputs[job].getReadPointer (ch), tailJobOutputs[job].getWritePointer (ch));
+
+        numTailPartitionsDone.fetch_add (1, std::memory_order_release);
+    }
+
+    void stopTailThread()
+    {
+        if (tailThread != nullptr)
+        {
+            tailThread->signalThreadShouldExit();
+            tailThread->notify();
+            tailThread->stopThread (1000);
+            tailThread.reset();
+        }
+
+        //止めるまでに終わらなかった仕事があっても、次の reset() が待ち続けないように
+        numTailPartitionsDone.store (numTailPartitionsStarted.load());
+    }
+};
+
+//==============================================================================
+/** A guitar cabinet convolved with PartitionedConvolution. PartitionedConvolution only
+    processes float, so other sample types go through a float buffer allocated in prepare(),
+    as in AnyPrecisionReverb.
+*/
+template <typename Type>
+class CabSimulator
+{
+public:
+    //==============================================================================
+    /** The impulse response is compiled in (see CabImpulseResponses.cpp), so nothing is read
+        from disk and nothing is transformed here.
+    */
+    CabSimulator()
+    {
+        using namespace CabImpulseResponses;
+
+        auto& convolution = processorChain.template get<convolutionIndex>();
+        convolution.setPartitionSizes (headSize, tailSize);
+        convolution.loadPreparedImpulseResponses ({
+            { GuitarAmp44100::sampleRate, headSize, tailSize, GuitarAmp44100::numChannels,
+              GuitarAmp44100::numHeadPartitions, GuitarAmp44100::numTailPartitions,
+              GuitarAmp44100::directTaps, GuitarAmp44100::headSpectra, GuitarAmp44100::tailSpectra },
+            { GuitarAmp48000::sampleRate, headSize, tailSize, GuitarAmp48000::numChannels,
+              GuitarAmp48000::numHeadPartitions, GuitarAmp48000::numTailPartitions,
+              GuitarAmp48000::directTaps, GuitarAmp48000::headSpectra, GuitarAmp48000::tailSpectra }
+        });
+    }
+
+    //==============================================================================
+    void prepare (const juce::dsp::ProcessSpec& spec)
+    {
+        auto& convolution = processorChain.template get<convolutionIndex>();
+
+        //用意していないサンプルレートでは、埋め込んだ元のサンプルから作る
+        if (! convolution.hasPreparedImpulseResponse (spec.sampleRate))
+            convolution.loadImpulseResponse (getGuitarAmpSamples(), CabImpulseResponses::guitarAmpSampleRate);
+
+        processorChain.prepare (spec);
+        floatBlock = juce::dsp::AudioBlock<float> (heapBlock, spec.numChannels, spec.maximumBlockSize);
+    }
+
+    //==============================================================================
+    template <typename ProcessContext>
+    void process (const ProcessContext& context) noexcept
+    {
+        process (context, std::is_same<Type, float>());
+    }
+
+    //==============================================================================
+    void reset() noexcept
+    {
+        processorChain.reset();
+    }
+
+private:
+    //==============================================================================
+    enum
+    {
+        convolutionIndex
+    };
+
+    juce::dsp::ProcessorChain<PartitionedConvolution> processorChain;
+
+    juce::HeapBlock<char> heapBlock;
+    juce::dsp::AudioBlock<float> floatBlock;
+
+    //==============================================================================
+    template <typename ProcessContext>
+    void process (const ProcessContext& context, std::true_type) noexcept
+    {
+        processorChain.process (context);
+    }
+
+    template <typename ProcessContext>
+    void process (const ProcessContext& context, std::false_type) noexcept
+    {
+        auto&& inputBlock = context.getInputBlock();
+        auto&& outputBlock = context.getOutputBlock();
+        auto numChannels = outputBlock.getNumChannels();
+        auto numSamples = outputBlock.getNumSamples();
+
+        //バイパス中にfloatを通すと精度が落ちるだけなので、そのまま返す
+        if (context.isBypassed)
+        {
+            if (context.usesSeparateInputAndOutputBlocks())
+                outputBlock.copyFrom (inputBlock);
+
+            return;
+        }
+
+        jassert (numChannels <= floatBlock.getNumChannels());
+        auto block = floatBlock.getSubsetChannelBlock (0, numChannels).getSubBlock (0, numSamples);
+
+        for (size_t ch = 0; ch < numChannels; ++ch)
+        {
+            auto* src = inputBlock.getChannelPointer (ch);
+            auto* dst = block.getChannelPointer (ch);
+
+            for (size_t i = 0; i < numSamples; ++i)
+                dst[i] = (float) src[i];
+        }
+
+        juce::dsp::ProcessContextReplacing<float> floatContext (block);
+        floatContext.isBypassed = context.isBypassed;
+        processorChain.process (floatContext);
+
+        for (size_t ch = 0; ch < numChannels; ++ch)
+        {
+            auto* src = block.getChannelPointer (ch);
+            auto* dst = outputBlock.getChannelPointer (ch);
+
+            for (size_t i = 0; i < numSamples; ++i)
+                dst[i] = (Type) src[i];
+        }
+    }
+
+    //==============================================================================
+    static juce::AudioBuffer<float> getGuitarAmpSamples()
+    {
+        using namespace CabImpulseResponses;
+
+        juce::AudioBuffer<float> samples (guitarAmpNumChannels, guitarAmpNumSamples);
+
+        for (int ch = 0; ch < guitarAmpNumChannels; ++ch)
+            for (int i = 0; i < guitarAmpNumSamples; ++i)
+                samples.setSample (ch, i, (float) guitarAmpSamples[ch * guitarAmpNumSamples + i] / 32768.0f);
+
+        return samples;
+    }
+};
+
+//==============================================================================
+/** Interpolation policies for reading fractional delays from a DelayLine.
+    The policy is a template parameter, so there is no runtime dispatch in the inner loop.
+    Each policy's order is how many samples past the integer delay it may read.
+*/
+namespace DelayLineInterpolation
+{
+    //==============================================================================
+    /** Rounds the delay to the nearest whole sample. */
+    template <typename Type>
+    struct None
+    {
+        static constexpr size_t order = 0;
+
+        void reset() noexcept {}
+
+        template <typename SampleAt>
+        Type interpolate (SampleAt sampleAt, Type delayInSamples) noexcept
+        {
+            return sampleAt ((size_t) juce::roundToInt (delayInSamples));
+        }
+    };
+
+    //==============================================================================
+    template <typename Type>
+    struct Linear
+    {
+        static constexpr size_t order = 1;
+
+        void reset() noexcept {}
+
+        template <typename SampleAt>
+        Type interpolate (SampleAt sampleAt, Type delayInSamples) noexcept
+        {
+            auto delayInt = (size_t) delayInSamples;
+            auto delayFrac = delayInSamples - (Type) delayInt;
+
+            auto value1 = sampleAt (delayInt);
+            auto value2 = sampleAt (delayInt + 1);
+
+            return value1 + delayFrac * (value2 - value1);
+        }
+    };
+
+    //==============================================================================
+    template <typename Type>
+    struct Lagrange3rd
+    {
+        static constexpr size_t order = 3;
+
+        void reset() noexcept {}
+
+        template <typename SampleAt>
+        Type interpolate (SampleAt sampleAt, Type delayInSamples) noexcept
+        {
+            auto delayInt = (size_t) delayInSamples;
+            auto delayFrac = delayInSamples - (Type) delayInt;
+
+            //4点の真ん中の区間 [1, 2) で補間するように一つずらす
+            if (delayInt >= 1)
+            {
+                --delayInt;
+                delayFrac += Type (1);
+            }
+
+            auto value1 = sampleAt (delayInt);
+            auto value2 = sampleAt (delayInt + 1);
+            auto value3 = sampleAt (delayInt + 2);
+            auto value4 = sampleAt (delayInt + 3);
+
+            auto d1 = delayFrac - Type (1);
+            auto d2 = delayFrac - Type (2);
+            auto d3 = delayFrac - Type (3);
+
+            auto c1 = -d1 * d2 * d3 / Type (6);
+            auto c2 = d2 * d3 / Type (2);
+            auto c3 = -d1 * d3 / Type (2);
+            auto c4 = d1 * d2 / Type (6);
+
+            return value1 * c1 + delayFrac * (value2 * c2 + value3 * c3 + value4 * c4);
+        }
+    };
+
+    //==============================================================================
+    /** First order allpass. It keeps state, so use one per read position and read once per push. */
+    template <typename Type>
+    struct Thiran
+    {
+        static constexpr size_t order = 1;
+
+        void reset() noexcept
+        {
+            lastOutput = Type (0);
+        }
+
+        template <typename SampleAt>
+        Type interpolate (SampleAt sampleAt, Type delayInSamples) noexcept
+        {
+            auto delayInt = (size_t) delayInSamples;
+            auto delayFrac = delayInSamples - (Type) delayInt;
+
+            //端数が小さいと係数が1に近づいて減衰しにくくなるので、端数を [0.618, 1.618) に収める
+            if (delayFrac < Type (0.618) && delayInt >= 1)
+            {
+                --delayInt;
+                delayFrac += Type (1);
+            }
+
+            auto alpha = (Type (1) - delayFrac) / (Type (1) + delayFrac);
+
+            auto value1 = sampleAt (delayInt);
+            auto value2 = sampleAt (delayInt + 1);
+
+            lastOutput = value2 + alpha * (value1 - lastOutput);
+            return lastOutput;
+        }
+
+        Type lastOutput = Type (0);
+    };
+}
+
+//==============================================================================
+template <typename Type, template <typename> class Interpolation = DelayLineInterpolation::None>
+class DelayLine
+{
+public:
+    void clear() noexcept
+    {
+        std::fill (rawData.begin(), rawData.end(), Type (0));
+        interpolator.reset();
+    }
+
+    /** Resets only the interpolation state (e.g. Thiran's), leaving the samples untouched */
+    void resetInterpolation() noexcept
+    {
+        interpolator.reset();
+    }
+
+    size_t size() const noexcept
+    {
+        return length;
+    }
+
+    /** Allocates room for at least maxSize samples, so that resize() never allocates up to that size */
+    void reserve (size_t maxSize)
+    {
+        //バッファの容量は2のべき乗に切り上げて、インデックスの折り返しを % ではなくマスクで行う
+        auto capacity = (size_t) juce::nextPowerOfTwo ((int) juce::jmax (maxSize, (size_t) 1));
+
+        if (capacity > rawData.size())
+        {
+            //マスクが変わるとサンプルの位置がずれるので、中身は捨てる
+            rawData.assign (capacity, Type (0));
+            mask = capacity - 1;
+            mostRecentIndex = 0;
+        }
+    }
+
+    void resize (size_t newValue)
+    {
+        //確保済みの容量に収まる場合は論理的な長さ（size() が返す値）を変えるだけで、アロケーションしない
+        reserve (newValue);
+        length = newValue;
+    }
+
+    Type back() const noexcept
+    {
+        return get (length - 1);
+    }
+
+    Type get (size_t delayInSamples) const noexcept
+    {
+        jassert(delayInSamples >= 0 && delayInSamples < size());
+        
+        //最新のサンプル位置(mostRecentIndex)から何サンプル戻るか（delayInSamples）、マスクで折り返す
+        return rawData[(mostRecentIndex - delayInSamples) & mask];
+    }
+
+    /** Reads a fractional delay, interpolated according to the Interpolation policy.
+        The policy reads up to its order samples past the integer delay, so the delay is
+        clamped to size() - 1 - order: size the line with that much headroom.
+        Not const, because stateful policies (Thiran) advance their state on every read.
+    */
+    Type getInterpolated (Type delayInSamples) noexcept
+    {
+        jassert (delayInSamples >= Type (0) && size() > Interpolation<Type>::order);
+
+        auto maxDelayInSamples = juce::jmax (Type (0), (Type) size() - (Type) (Interpolation<Type>::order + 1));
+        delayInSamples = juce::jlimit (Type (0), maxDelayInSamples, delayInSamples);
+
+        return interpolator.interpolate ([this] (size_t d) { return rawData[(mostRecentIndex - d) & mask]; },
+                                         delayInSamples);
+    }
+
+    /** Set the specified sample in the delay line */
+    void set (size_t delayInSamples, Type newValue) noexcept
+    {
+        jassert(delayInSamples >= 0 && delayInSamples < size());
+        //特定の位置でサンプルを書き換え
+        rawData[(mostRecentIndex - delayInSamples) & mask] = newValue;
+    }
+
+    /** Adds a new value to the delay line, overwriting the least recently added sample */
+    void push (Type valueToAdd) noexcept
+    {
+        //書き込み位置を一つ進めて（マスクで折り返す）、一番古いサンプルを書き換え
+        //分岐も除算もなし
+        mostRecentIndex = (mostRecentIndex + 1) & mask;
+        rawData[mostRecentIndex] = valueToAdd;
+    }
+
+    //==============================================================================
+    /** Returns the (at most two) contiguous regions of the buffer that get (delayInSamples)
+        would read from over the next numSamples pushes, like AbstractFifo::prepareToRead.
+    */
+    void prepareToRead (size_t delayInSamples, size_t numSamples,
+                        const Type*& block1, size_t& size1,
+                        const Type*& block2, size_t& size2) const noexcept
+    {
+        //このブロックで書き込むサンプルを読まないように、遅延はブロック長-1以上が必要
+        jassert (delayInSamples + 1 >= numSamples && delayInSamples < size());
+
+        auto start = (mostRecentIndex - delayInSamples) & mask;
+        size1 = juce::jmin (numSamples, rawData.size() - start);
+        size2 = numSamples - size1;
+        block1 = rawData.data() + start;
+        block2 = rawData.data();
+    }
+
+    /** Returns the (at most two) contiguous regions of the buffer that the next numSamples
+        pushes would write to. Call finishedWrite() once they have been filled.
+    */
+    void prepareToWrite (size_t numSamples,
+                         Type*& block1, size_t& size1,
+                         Type*& block2, size_t& size2) noexcept
+    {
+        jassert (numSamples <= rawData.size());
+
+        auto start = (mostRecentIndex + 1) & mask;
+        size1 = juce::jmin (numSamples, rawData.size() - start);
+        size2 = numSamples - size1;
+        block1 = rawData.data() + start;
+        block2 = rawData.data();
+    }
+
+    void finishedWrite (size_t numSamples) noexcept
+    {
+        mostRecentIndex = (mostRecentIndex + numSamples) & mask;
+    }
+
+    /** Reads numSamples delayed samples into dest, as calling get (delayInSamples) once per push would */
+    void readBlock (size_t delayInSamples, Type* dest, size_t numSamples) const noexcept
+    {
+        const Type* block1;
+        const Type* block2;
+        size_t size1, size2;
+        prepareToRead (delayInSamples, numSamples, block1, size1, block2, size2);
+
+        juce::FloatVectorOperations::copy (dest, block1, (int) size1);
+        juce::FloatVectorOperations::copy (dest + size1, block2, (int) size2);
+    }
+
+    /** Reads numSamples interpolated samples into dest, as calling get (delayInSamples) once per push would.
+        The delay must be at least numSamples so that every interpolation tap is older than the block.
+    */
+    void readBlock (Type delayInSamples, Type* dest, size_t numSamples) noexcept
+    {
+        jassert (delayInSamples >= (Type) numSamples && delayInSamples < (Type) size());
+
+        for (size_t i = 0; i < numSamples; ++i)
+            dest[i] = getInBlock (delayInSamples, i);
+    }
+
+    /** Returns what getInterpolated (delayInSamples) will return after offset more pushes, for
+        a block of pushes that is written only after it has been read. The delay must be at least
+        the block length. Lets several delays be read sample by sample in one pass over the block.
+    */
+    Type getInBlock (Type delayInSamples, size_t offset) noexcept
+    {
+        jassert (delayInSamples > (Type) offset && delayInSamples < (Type) size());
+
+        return interpolator.interpolate ([this, offset] (size_t d) { return rawData[(mostRecentIndex + offset - d) & mask]; },
+                                         delayInSamples);
+    }
+
+    /** Pushes numSamples values at once, as calling push() for each of them would */
+    void writeBlock (const Type* src, size_t numSamples) noexcept
+    {
+        Type* block1;
+        Type* block2;
+        size_t size1, size2;
+        prepareToWrite (numSamples, block1, size1, block2, size2);
+
+        juce::FloatVectorOperations::copy (block1, src, (int) size1);
+        juce::FloatVectorOperations::copy (block2, src + size1, (int) size2);
+        finishedWrite (numSamples);
+    }
+
+private:
+    std::vector<Type> rawData;
+    size_t length = 0;
+    size_t mask = 0;
+    size_t mostRecentIndex = 0;
+
+    Interpolation<Type> interpolator;
+};
+
+//==============================================================================
+#if JUCE_USE_SIMD
+/** SIMDRegister has no division, so use the native instruction where there is one */
+template <typename Type>
+inline juce::dsp::SIMDRegister<Type> divide (juce::dsp::SIMDRegister<Type> a, juce::dsp::SIMDRegister<Type> b) noexcept
+{
+    juce::dsp::SIMDRegister<Type> result;
+
+    for (size_t i = 0; i < juce::dsp::SIMDRegister<Type>::size(); ++i)
+        result.set (i, a.get (i) / b.get (i));
+
+    return result;
+}
+
+ #if JUCE_USE_SSE_INTRINSICS
+inline juce::dsp::SIMDRegister<float> divide (juce::dsp::SIMDRegister<float> a, juce::dsp::SIMDRegister<float> b) noexcept
+{
+    return juce::dsp::SIMDRegister<float>::fromNative (_mm_div_ps (a.value, b.value));
+}
+
+inline juce::dsp::SIMDRegister<double> divide (juce::dsp::SIMDRegister<double> a, juce::dsp::SIMDRegister<double> b) noexcept
+{
+    return juce::dsp::SIMDRegister<double>::fromNative (_mm_div_pd (a.value, b.value));
+}
+ #elif JUCE_USE_ARM_NEON && JUCE_64BIT
+inline juce::dsp::SIMDRegister<float> divide (juce::dsp::SIMDRegister<float> a, juce::dsp::SIMDRegister<float> b) noexcept
+{
+    return juce::dsp::SIMDRegister<float>::fromNative (vdivq_f32 (a.value, b.value));
+}
+ #endif
+#endif
+
+//==============================================================================
+/** Saturation policies for the FX chain. Both have the same static interface, so they
+    can be swapped as a template parameter of Delay and Distortion.
+*/
+template <typename Type>
+struct ExactTanh
+{
+    static Type processSample (Type x) noexcept
+    {
+        return std::tanh (x);
+    }
+
+    static void process (Type* data, size_t numSamples) noexcept
+    {
+        for (size_t i = 0; i < numSamples; ++i)
+            data[i] = std::tanh (data[i]);
+    }
+
+   #if JUCE_USE_SIMD
+    static juce::dsp::SIMDRegister<Type> processSIMD (juce::dsp::SIMDRegister<Type> x) noexcept
+    {
+        for (size_t i = 0; i < juce::dsp::SIMDRegister<Type>::size(); ++i)
+            x.set (i, std::tanh (x.get (i)));
+
+        return x;
+    }
+   #endif
+};
+
+//==============================================================================
+/** [7/6] Padé approximation of tanh. The input is clipped where the approximation reaches 1,
+    which keeps it monotonic and bounded, with a maximum error of about 1e-4.
+*/
+template <typename Type>
+struct FastTanh
+{
+    static Type processSample (Type x) noexcept
+    {
+        x = juce::jlimit (-clipLevel(), clipLevel(), x);
+        auto x2 = x * x;
+
+        auto numerator   = x * (((x2 + Type (378)) * x2 + Type (17325)) * x2 + Type (135135));
+        auto denominator = ((x2 * Type (28) + Type (3150)) * x2 + Type (62370)) * x2 + Type (135135);
+
+        return numerator / denominator;
+    }
+
+   #if JUCE_USE_SIMD
+    static juce::dsp::SIMDRegister<Type> processSIMD (juce::dsp::SIMDRegister<Type> x) noexcept
+    {
+        using Register = juce::dsp::SIMDRegister<Type>;
+
+        x = Register::max (Register::expand (-clipLevel()), Register::min (Register::expand (clipLevel()), x));
+        auto x2 = x * x;
+
+        auto numerator   = x * (((x2 + Type (378)) * x2 + Type (17325)) * x2 + Type (135135));
+        auto denominator = ((x2 * Type (28) + Type (3150)) * x2 + Type (62370)) * x2 + Type (135135);
+
+        return divide (numerator, denominator);
+    }
+   #endif
+
+    static void process (Type* data, size_t numSamples) noexcept
+    {
+       #if JUCE_USE_SIMD
+        using Register = juce::dsp::SIMDRegister<Type>;
+
+        //アラインされていない先頭と、レジスタに満たない末尾はスカラーで処理する
+        auto* end = data + numSamples;
+        auto* alignedStart = juce::jmin (Register::getNextSIMDAlignedPtr (data), end);
+
+        for (; data < alignedStart; ++data)
+            *data = processSample (*data);
+
+        for (; data + Register::size() <= end; data += Register::size())
+            processSIMD (Register::fromRawArray (data)).copyToRawArray (data);
+
+        for (; data < end; ++data)
+            *data = processSample (*data);
+       #else
+        for (size_t i = 0; i < numSamples; ++i)
+            data[i] = processSample (data[i]);
+       #endif
+    }
+
+    static constexpr Type clipLevel() noexcept { return Type (4.97); }
+};
+
+//==============================================================================
+/** A WaveShaper that runs one of the saturation policies above over whole blocks */
+template <typename Type, template <typename> class Saturation = FastTanh>
+class TanhWaveShaper
+{
+public:
+    //==============================================================================
+    void prepare (const juce::dsp::ProcessSpec&) noexcept {}
+    void reset() noexcept {}
+
+    //==============================================================================
+    template <typename ProcessContext>
+    void process (const ProcessContext& context) noexcept
+    {
+        auto&& inputBlock = context.getInputBlock();
+        auto&& outputBlock = context.getOutputBlock();
+        auto numSamples = outputBlock.getNumSamples();
+
+        jassert (inputBlock.getNumChannels() == outputBlock.getNumChannels());
+        jassert (inputBlock.getNumSamples() == numSamples);
+
+        if (context.usesSeparateInputAndOutputBlocks())
+            outputBlock.copyFrom (inputBlock);
+
+        if (context.isBypassed)
+            return;
+
+        for (size_t ch = 0; ch < outputBlock.getNumChannels(); ++ch)
+            Saturation<Type>::process (outputBlock.getChannelPointer (ch), numSamples);
+    }
+};
+
+//==============================================================================
+/** TanhWaveShaper run at a multiple of the sample rate, so that the harmonics it adds above
+    Nyquist are filtered out instead of folding back down. Only the waveshaper is oversampled;
+    whatever comes before and after it in a chain stays at the base rate.
+*/
+template <typename Type, template <typename> class Saturation = FastTanh>
+class OversampledWaveShaper
+{
+public:
+    //==============================================================================
+    enum class FilterType
+    {
+        polyphaseIIR,   // 位相は歪むが軽く、レイテンシも小さい
+        equirippleFIR   // 直線位相だが重く、レイテンシも大きい
+    };
+
+    /** factorLog2 of 0 turns oversampling off, 1, 2 and 3 run at 2x, 4x and 8x.
+        Takes effect at the next prepare().
+    */
+    void setOversampling (size_t newFactorLog2, FilterType newFilterType = FilterType::polyphaseIIR)
+    {
+        jassert (newFactorLog2 <= 3);
+        factorLog2 = juce::jmin (newFactorLog2, (size_t) 3);
+        filterType = newFilterType;
+    }
+
+    /** Latency added by the oversampling filters, at the base sample rate */
+    Type getLatencyInSamples() const noexcept
+    {
+        return oversampling != nullptr ? (Type) oversampling->getLatencyInSamples() : Type (0);
+    }
+
+    //==============================================================================
+    void prepare (const juce::dsp::ProcessSpec& spec)
+    {
+        oversampling.reset();
+
+        if (factorLog2 > 0)
+        {
+            auto type = filterType == FilterType::polyphaseIIR ? juce::dsp::Oversampling<Type>::filterHalfBandPolyphaseIIR
+                                                               : juce::dsp::Oversampling<Type>::filterHalfBandFIREquiripple;
+
+            //レイテンシをsetLatencySamplesで正確に伝えられるよう、整数サンプルにしておく
+            oversampling = std::make_unique<juce::dsp::Oversampling<Type>> (spec.numChannels, factorLog2, type, true, true);
+            oversampling->initProcessing (spec.maximumBlockSize);
+        }
+
+        waveShaper.prepare ({ spec.sampleRate * (double) ((size_t) 1 << factorLog2),
+                              spec.maximumBlockSize << factorLog2, spec.numChannels });
+    }
+
+    void reset() noexcept
+    {
+        if (oversampling != nullptr)
+            oversampling->reset();
+
+        waveShaper.reset();
+    }
+
+    //==============================================================================
+    template <typename ProcessContext>
+    void process (const ProcessContext& context) noexcept
+    {
+        if (oversampling == nullptr)
+        {
+            waveShaper.process (context);
+            return;
+        }
+
+        auto&& outputBlock = context.getOutputBlock();
+
+        if (context.usesSeparateInputAndOutputBlocks())
+            outputBlock.copyFrom (context.getInputBlock());
+
+        if (context.isBypassed)
+            return;
+
+        auto upsampledBlock = oversampling->processSamplesUp (outputBlock);
+        waveShaper.process (juce::dsp::ProcessContextReplacing<Type> (upsampledBlock));
+        oversampling->processSamplesDown (outputBlock);
+    }
+
+private:
+    //==============================================================================
+    TanhWaveShaper<Type, Saturation> waveShaper;
+    std::unique_ptr<juce::dsp::Oversampling<Type>> oversampling;
+    size_t factorLog2 = 0;
+    FilterType filterType = FilterType::polyphaseIIR;
+};
+
+//==============================================================================
+/** Waveshaping functions with their first and second antiderivatives, for ADAAWaveShaper.
+    Everything is in double: the antiderivatives grow like x^2 and x^3, and their differences
+    over a single sample are far too small for float.
+*/
+namespace ADAAFunctions
+{
+    struct HardClip
+    {
+        static double process (double x) noexcept         { return juce::jlimit (-1.0, 1.0, x); }
+
+        static double antiderivative1 (double x) noexcept
+        {
+            return std::abs (x) <= 1.0 ? 0.5 * x * x : std::abs (x) - 0.5;
+        }
+
+        static double antiderivative2 (double x) noexcept
+        {
+            if (std::abs (x) <= 1.0)
+                return x * x * x / 6.0;
+
+            return (x > 0.0 ? 1.0 : -1.0) * (0.5 * x * x + 1.0 / 6.0) - 0.5 * x;
+        }
+    };
+
+    struct Tanh
+    {
+        static constexpr double ln2 = 0.693147180559945309417;
+
+        static double process (double x) noexcept         { return std::tanh (x); }
+
+        //log cosh x を、大きなxでもオーバーフローしない形で
+        static double antiderivative1 (double x) noexcept
+        {
+            auto a = std::abs (x);
+            return a + std::log1p (std::exp (-2.0 * a)) - ln2;
+        }
+
+        //x >= 0 で x^2/2 - x ln2 + Li2(-e^-2x)/2 + pi^2/24、奇関数なので負側は符号を反転
+        static double antiderivative2 (double x) noexcept
+        {
+            auto a = std::abs (x);
+            auto value = 0.5 * a * a - a * ln2
+                       + 0.5 * dilogarithm (-std::exp (-2.0 * a))
+                       + juce::MathConstants<double>::pi * juce::MathConstants<double>::pi / 24.0;
+
+            return x < 0.0 ? -value : value;
+        }
+
+        //Li2(z), -1 <= z <= 0。Landenの式で w = z/(z-1) (0..0.5) の級数にすると速く収束する
+        static double dilogarithm (double z) noexcept
+        {
+            auto w = z / (z - 1.0);
+            auto logTerm = std::log1p (-z);
+            auto sum = 0.0, power = w;
+
+            for (int k = 1; k <= 50 && power > 1e-17; ++k, power *= w)
+                sum += power / (double) (k * k);
+
+            return -sum - 0.5 * logTerm * logTerm;
+        }
+    };
+}
+
+//==============================================================================
+/** A waveshaper with antiderivative anti-aliasing (ADAA): instead of sampling f (x), each
+    output is the average of f over the input segment between consecutive samples, computed
+    from f's antiderivatives. That removes most of the aliasing at the base sample rate.
+
+    order 1 averages over one segment and delays the signal by half a sample; order 2 uses
+    two segments, suppresses aliasing further and delays by one sample. It has the same
+    interface as OversampledWaveShaper, so it can go in the same slot of Distortion.
+*/
+template <typename Type, typename Function = ADAAFunctions::Tanh, int order = 1>
+class ADAAWaveShaper
+{
+public:
+    static_assert (order == 1 || order == 2, "Only first and second order ADAA are implemented");
+
+    //==============================================================================
+    void prepare (const juce::dsp::ProcessSpec& spec)
+    {
+        states.resize (spec.numChannels);
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        std::fill (states.begin(), states.end(), ChannelState());
+    }
+
+    Type getLatencyInSamples() const noexcept     { return Type (order) / Type (2); }
+
+    //==============================================================================
+    template <typename ProcessContext>
+    void process (const ProcessContext& context) noexcept
+    {
+        auto&& outputBlock = context.getOutputBlock();
+        auto numSamples = outputBlock.getNumSamples();
+
+        jassert (outputBlock.getNumChannels() <= states.size());
+
+        if (context.usesSeparateInputAndOutputBlocks())
+            outputBlock.copyFrom (context.getInputBlock());
+
+        if (context.isBypassed)
+            return;
+
+        for (size_t ch = 0; ch < outputBlock.getNumChannels(); ++ch)
+        {
+            auto* samples = outputBlock.getChannelPointer (ch);
+            auto& state = states[ch];
+
+            for (size_t i = 0; i < numSamples; ++i)
+                samples[i] = (Type) processSample ((double) samples[i], state);
+        }
+    }
+
+private:
+    //==============================================================================
+    //x1, x2は1、2サンプル前の入力。F1, F2はその位置での不定積分の値
+    struct ChannelState
+    {
+        double x1 = 0.0, x2 = 0.0;
+        double F1 = Function::antiderivative1 (0.0);
+        double F2 = Function::antiderivative2 (0.0), F2Previous = Function::antiderivative2 (0.0);
+    };
+
+    std::vector<ChannelState> states;
+
+    //これより近い2点の差分商は桁落ちするので、中点での値で代用する
+    static constexpr double tolerance = 1e-5;
+
+    //2次は差分商の差をさらに x - x2 (重なる時は delta の2乗) で割るので桁落ちが大きく、閾値も大きくする
+    static constexpr double secondOrderTolerance = 1e-3;
+
+    static double processSample (double x, ChannelState& state) noexcept
+    {
+        return processSample (x, state, std::integral_constant<int, order>());
+    }
+
+    static double processSample (double x, ChannelState& state, std::integral_constant<int, 1>) noexcept
+    {
+        auto F1 = Function::antiderivative1 (x);
+        auto dx = x - state.x1;
+
+        auto y = std::abs (dx) < tolerance ? Function::process (0.5 * (x + state.x1))
+                                           : (F1 - state.F1) / dx;
+
+        state.x1 = x;
+        state.F1 = F1;
+        return y;
+    }
+
+    static double processSample (double x, ChannelState& state, std::integral_constant<int, 2>) noexcept
+    {
+        auto F2 = Function::antiderivative2 (x);
+        auto x1 = state.x1, x2 = state.x2;
+
+        double y;
+
+        if (std::abs (x - x2) < secondOrderTolerance)
+        {
+            //x と x2 が重なる時は、その中点 xBar と x1 の間の1区間で計算する
+            //重みはxBarに向かって直線的に増えるので、x1も近い時は重心 (2 xBar + x1) / 3 の値で代用する
+            auto xBar = 0.5 * (x + x2);
+            auto delta = xBar - x1;
+
+            y = std::abs (delta) < secondOrderTolerance
+                  ? Function::process ((2.0 * xBar + x1) / 3.0)
+                  : 2.0 / delta * (Function::antiderivative1 (xBar) + (state.F2 - Function::antiderivative2 (xBar)) / delta);
+        }
+        else
+        {
+            y = 2.0 / (x - x2) * (firstDifference (x, x1, F2, state.F2) - firstDifference (x1, x2, state.F2, state.F2Previous));
+        }
+
+        state.x2 = x1;
+        state.x1 = x;
+        state.F2Previous = state.F2;
+        state.F2 = F2;
+        return y;
+    }
+
+    //(F2(a) - F2(b)) / (a - b)
+    static double firstDifference (double a, double b, double F2a, double F2b) noexcept
+    {
+        auto d = a - b;
+        return std::abs (d) < tolerance ? Function::antiderivative1 (0.5 * (a + b)) : (F2a - F2b) / d;
+    }
+};
+
+//==============================================================================
+/** A feedback delay with one DelayLine per channel.
+
+    The number of channels is taken from the ProcessSpec in prepare(), so the same Delay
+    runs on stereo, surround or ambisonic buses. Before prepare() there are two channels;
+    channels added by prepare() start with the existing delay times in turn (channel n
+    starts with the delay time of channel n % numExisting).
+*/
+template <typename Type,
+          template <typename> class Interpolation = DelayLineInterpolation::Lagrange3rd,
+          template <typename> class Saturation = FastTanh>
+class Delay
+{
+public:
+    //==============================================================================
+    Delay()
+    {
+        delayTimes.resize(numDefaultChannels);
+        delayTimesInBeats.resize(numDefaultChannels);
+
+        setMaxDelayTime(2.0f);
+        setDelayTime(0, 0.7f);
+        setDelayTime(1,0.5f);
+        setDelayTimeInBeats(0, 1.5f);
+        setDelayTimeInBeats(1, 1.0f);
+        setWetLevel(0.8f);
+        setFeedback(0.5f);
+    }
+
+    //==============================================================================
+    void prepare (const juce::dsp::ProcessSpec& spec)
+    {
+        jassert(spec.numChannels > 0);
+        //Typeとつけるのは、クラスをtemplateにしてるから。Delayクラスを扱うときに、doubleでもfloatでも対応できるようにする
+        sampleRate = (Type) spec.sampleRate;
+
+        //チャンネル数はホストのレイアウトで決まるので、ここで必要な分だけ用意する
+        auto numChannels = (size_t) spec.numChannels;
+        delayLines.resize(numChannels);
+        delayTimesSample.resize(numChannels);
+        addChannelValues(delayTimes, numChannels);
+        addChannelValues(delayTimesInBeats, numChannels);
+        lpFilterStates.assign(numChannels, Type(0));
+        blockwiseChannels.reserve(numChannels);
+        sampleBySampleChannels.reserve(numChannels);
+
+        //再生中にアロケーションしないように、最大遅延時間分のメモリはここで確保しておく
+        delayLineCapacity = getDelayLineSizeSamples();
+
+        for (auto& dline : delayLines)
+            dline.reserve(delayLineCapacity);
+
+        //secで指定したパラメータにサンプルレートをかけてサンプル時間にして保存
+        updateDelayLineSize();
+
+        for (auto& dt : delayTimesSample)
+            dt.reset(spec.sampleRate, delayTimeRampSeconds);
+
+        updateDelayTime(false);
+        
+        //全チャンネルで同じ係数を使うので、状態だけをチャンネルごとに持つ
+        auto lpFilterCoefs = juce::dsp::IIR::Coefficients<Type>::makeFirstOrderLowPass(sampleRate, Type(1e3));
+        auto* rawCoefs = lpFilterCoefs->getRawCoefficients();
+        lpB0 = rawCoefs[0];
+        lpB1 = rawCoefs[1];
+        lpA1 = rawCoefs[2];
+
+        //ブロック処理用の作業バッファ（チャンネルごとの遅延信号と、DelayLineへの入力信号）
+        scratchBlock = juce::dsp::AudioBlock<Type> (heapBlock, numChannels + 1, spec.maximumBlockSize);
+
+       #if JUCE_USE_SIMD
+        //LPF用に、レジスタ幅のチャンネルをサンプルごとに並べ替えておく作業バッファ
+        using Register = juce::dsp::SIMDRegister<Type>;
+        lowpassStorage.assign(spec.maximumBlockSize * Register::size() + Register::size(), Type(0));
+        lowpassFrames = Register::getNextSIMDAlignedPtr(lowpassStorage.data());
+       #endif
+    }
+
+    //==============================================================================
+    void reset() noexcept
+    {
+        //フィルターをリセット
+        std::fill(lpFilterStates.begin(), lpFilterStates.end(), Type(0));
+        //バッファをクリア
+        for (auto& dline : delayLines)
+            dline.clear();
+    }
+
+    //==============================================================================
+    /** Returns the number of channels this Delay was prepared for */
+    size_t getNumChannels() const noexcept
+    {
+        return delayLines.size();
+    }
+
+    //==============================================================================
+    void setMaxDelayTime (Type newValue)
+    {
+        //0より大きい
+        jassert(newValue > Type(0));
+        maxDelayTime = newValue;
+        //maxDelayTimeの長さにDelayLineのサンプル数を合わせる（メモリの確保はprepareの時だけ）
+        updateDelayLineSize();
+        updateDelayTime();
+    }
+
+    //==============================================================================
+    void setFeedback (Type newValue) noexcept
+    {
+        jassert (newValue >= Type (0) && newValue <= Type (1));
+        feedback = newValue;
+    }
+
+    //==============================================================================
+    void setWetLevel (Type newValue) noexcept
+    {
+        jassert (newValue >= Type (0) && newValue <= Type (1));
+        wetLevel = newValue;
+    }
+
+    //==============================================================================
+    /** Sets the delay time of one channel in seconds. The channel must be one of the two
+        default channels, or one that prepare() has set up.
+    */
+    void setDelayTime (size_t channel, Type newValue)
+    {
+        jassert(newValue >= Type(0));
+        setChannelValue(delayTimes, channel, newValue);
+        
+        updateDelayTime();
+    }
+
+    //==============================================================================
+    /** Sets the delay time of one channel in beats (quarter notes), used in tempo-sync mode.
+        0.75 is a dotted eighth, 1.5 a dotted quarter and so on.
+    */
+    void setDelayTimeInBeats (size_t channel, Type newValue)
+    {
+        jassert(newValue >= Type(0));
+        setChannelValue(delayTimesInBeats, channel, newValue);
+
+        if (tempoSync)
+            updateDelayTime();
+    }
+
+    /** Switches between delay times in seconds and delay times in beats at the current tempo */
+    void setTempoSync (bool shouldSyncToTempo)
+    {
+        if (tempoSync == shouldSyncToTempo)
+            return;
+
+        tempoSync = shouldSyncToTempo;
+        updateDelayTime();
+    }
+
+    /** Sets the tempo used in tempo-sync mode. It can be called every block from the audio
+        thread: the delay times are only recomputed (and smoothed) when the tempo changes.
+    */
+    void setTempo (double newBpm) noexcept
+    {
+        jassert(newBpm > 0.0);
+
+        if (newBpm <= 0.0 || newBpm == bpm)
+            return;
+
+        bpm = newBpm;
+
+        if (tempoSync)
+            updateDelayTime();
+    }
+
+    //==============================================================================
+    template <typename ProcessContext>
+    void process (const ProcessContext& context) noexcept
+    {
+        //チャンネル数、サンプル数があっているか検査
+        auto& inputBlock = context.getInputBlock();
+        auto& outputBlock = context.getOutputBlock();
+        auto numSamples = outputBlock.getNumSamples();
+        auto numChannels = outputBlock.getNumChannels();
+        
+        jassert(inputBlock.getNumSamples() == numSamples);
+        jassert(inputBlock.getNumChannels() == numChannels);
+        jassert(numChannels <= getNumChannels());
+
+        //容量はprepareで確保済みなので、ここでpush_backしてもアロケーションは起きない
+        blockwiseChannels.clear();
+        sampleBySampleChannels.clear();
+
+        for (size_t ch = 0; ch < juce::jmin(numChannels, getNumChannels()); ++ch)
+        {
+            //遅延時間がブロック長以上なら、このブロックで書き込むサンプルを読むことはないので
+            //DelayLineをまとめて読み書きする。遅延時間が変化している間は1サンプルずつ
+            auto& delayTime = delayTimesSample[ch];
+
+            if (! delayTime.isSmoothing() && delayTime.getCurrentValue() >= (Type) numSamples)
+                blockwiseChannels.push_back(ch);
+            else
+                sampleBySampleChannels.push_back(ch);
+        }
+
+        if (! blockwiseChannels.empty())
+            processBlockwise(inputBlock, outputBlock, numSamples);
+
+        size_t n = 0;
+
+       #if JUCE_USE_SIMD
+        //1サンプルずつ処理するチャンネルは、SIMDレジスタの幅ずつまとめて処理する
+        //幅に満たない残りも2チャンネル以上なら、空きレーンを埋めてレジスタで処理する（ステレオのfloatなど）
+        constexpr auto numLanes = juce::dsp::SIMDRegister<Type>::size();
+
+        for (; n + 1 < sampleBySampleChannels.size(); n += numLanes)
+            processInterleaved(sampleBySampleChannels.data() + n,
+                               juce::jmin(numLanes, sampleBySampleChannels.size() - n),
+                               inputBlock, outputBlock, numSamples);
+       #endif
+
+        for (; n < sampleBySampleChannels.size(); ++n)
+        {
+            auto ch = sampleBySampleChannels[n];
+            processSampleBySample(ch, inputBlock.getChannelPointer(ch), outputBlock.getChannelPointer(ch), numSamples);
+        }
+
+        //prepareより多いチャンネルはディレイラインがないので、古い中身を残さず無音にする
+        for (auto ch = getNumChannels(); ch < numChannels; ++ch)
+            outputBlock.getSingleChannelBlock(ch).clear();
+    }
+
+private:
+    //==============================================================================
+    std::vector<DelayLine<Type, Interpolation>> delayLines;
+    std::vector<juce::SmoothedValue<Type>> delayTimesSample;
+    std::vector<Type> delayTimes, delayTimesInBeats;
+    Type feedback { Type (0) };
+    Type wetLevel { Type (0) };
+
+    bool tempoSync { false };
+    double bpm { 120.0 };
+
+    //フィードバックのLPF（1次、TDF2）。係数は全チャンネル共通
+    std::vector<Type> lpFilterStates;
+    Type lpB0 { Type (1) }, lpB1 { Type (0) }, lpA1 { Type (0) };
+
+    juce::HeapBlock<char> heapBlock;
+    juce::dsp::AudioBlock<Type> scratchBlock;
+    std::vector<size_t> blockwiseChannels, sampleBySampleChannels;
+
+   #if JUCE_USE_SIMD
+    std::vector<Type> lowpassStorage;
+    Type* lowpassFrames = nullptr;
+   #endif
+
+    Type sampleRate   { Type (44.1e3) };
+    Type maxDelayTime { Type (2) };
+    size_t delayLineCapacity { 0 };
+
+    static constexpr size_t interpolationHeadroom = 4;
+    static constexpr size_t numDefaultChannels = 2;
+
+    //遅延時間を変えた時に、クリックが出ないようにこの時間をかけて移動させる
+    static constexpr double delayTimeRampSeconds = 0.1;
+
+    //==============================================================================
+    //ミックスとフィードバックの計算をFloatVectorOperationsでまとめて行う
+    template <typename InputBlock, typename OutputBlock>
+    void processBlockwise (const InputBlock& inputBlock, OutputBlock& outputBlock, size_t numSamples) noexcept
+    {
+        //delaytimeだけ前のディレイのサンプルを全チャンネル分まとめて取得し、LPFにかける
+        for (auto ch : blockwiseChannels)
+            delayLines[ch].readBlock(delayTimesSample[ch].getCurrentValue(), scratchBlock.getChannelPointer(ch), numSamples);
+
+        processLowpassBlocks(numSamples);
+
+        auto* dlineInput = scratchBlock.getChannelPointer(getNumChannels());
+
+        for (auto ch : blockwiseChannels)
+        {
+            auto* input = inputBlock.getChannelPointer(ch);
+            auto* output = outputBlock.getChannelPointer(ch);
+            auto* delayed = scratchBlock.getChannelPointer(ch);
+
+            //ディレイ信号とinput信号を混ぜ、tanhで変位を0~1に抑えてpush
+            juce::FloatVectorOperations::copy(dlineInput, input, (int) numSamples);
+            juce::FloatVectorOperations::addWithMultiply(dlineInput, delayed, feedback, (int) numSamples);
+
+            Saturation<Type>::process(dlineInput, numSamples);
+
+            delayLines[ch].writeBlock(dlineInput, numSamples);
+
+            //delay信号をwet率で混ぜる（inputとoutputが同じバッファの場合もある）
+            if (output != input)
+                juce::FloatVectorOperations::copy(output, input, (int) numSamples);
+
+            juce::FloatVectorOperations::addWithMultiply(output, delayed, wetLevel, (int) numSamples);
+        }
+    }
+
+    //==============================================================================
+    Type processLowpassSample (size_t ch, Type x) noexcept
+    {
+        auto& state = lpFilterStates[ch];
+        auto y = lpB0 * x + state;
+        state = lpB1 * x - lpA1 * y;
+        return y;
+    }
+
+    /** Runs the feedback lowpass over the delayed blocks of blockwiseChannels in scratchBlock.
+        The filter is recursive in time, so the channels are what gets vectorised: up to
+        SIMDRegister<Type>::size() channels are interleaved into lowpassFrames, one aligned
+        register per sample, and their states stay in one register for the whole block.
+        Groups with fewer channels (e.g. stereo floats) leave the spare lanes at zero.
+    */
+    void processLowpassBlocks (size_t numSamples) noexcept
+    {
+        size_t n = 0;
+
+       #if JUCE_USE_SIMD
+        using Register = juce::dsp::SIMDRegister<Type>;
+        constexpr auto numLanes = Register::SIMDNumElements;
+
+        alignas (Register::SIMDRegisterSize) Type lanes[numLanes] = {};
+
+        //1チャンネルだけならスカラーの方が速いので、2チャンネル以上の組だけレジスタで処理する
+        for (; n + 1 < blockwiseChannels.size(); n += numLanes)
+        {
+            auto* channels = blockwiseChannels.data() + n;
+            auto numChannels = juce::jmin(numLanes, blockwiseChannels.size() - n);
+
+            //空きレーンは0のまま回す（状態も0なので出力も0のまま）
+            if (numChannels < numLanes)
+                std::fill(lowpassFrames, lowpassFrames + numSamples * numLanes, Type(0));
+
+            for (size_t lane = 0; lane < numChannels; ++lane)
+            {
+                auto* delayed = scratchBlock.getChannelPointer(channels[lane]);
+
+                for (size_t i = 0; i < numSamples; ++i)
+                    lowpassFrames[i * numLanes + lane] = delayed[i];
+
+                lanes[lane] = lpFilterStates[channels[lane]];
+            }
+
+            auto state = Register::fromRawArray(lanes);
+
+            for (size_t i = 0; i < numSamples; ++i)
+            {
+                auto* frame = lowpassFrames + i * numLanes;
+                processLowpassSIMD(Register::fromRawArray(frame), state).copyToRawArray(frame);
+            }
+
+            state.copyToRawArray(lanes);
+
+            for (size_t lane = 0; lane < numChannels; ++lane)
+            {
+                auto* delayed = scratchBlock.getChannelPointer(channels[lane]);
+
+                for (size_t i = 0; i < numSamples; ++i)
+                    delayed[i] = lowpassFrames[i * numLanes + lane];
+
+                lpFilterStates[channels[lane]] = lanes[lane];
+            }
+        }
+       #endif
+
+        for (; n < blockwiseChannels.size(); ++n)
+        {
+            auto ch = blockwiseChannels[n];
+            auto* delayed = scratchBlock.getChannelPointer(ch);
+
+            for (size_t i = 0; i < numSamples; ++i)
+                delayed[i] = processLowpassSample(ch, delayed[i]);
+        }
+    }
+
+   #if JUCE_USE_SIMD
+    juce::dsp::SIMDRegister<Type> processLowpassSIMD (juce::dsp::SIMDRegister<Type> x, juce::dsp::SIMDRegister<Type>& state) const noexcept
+    {
+        auto y = x * lpB0 + state;
+        state = x * lpB1 - y * lpA1;
+        return y;
+    }
+   #endif
+
+    //==============================================================================
+    void processSampleBySample (size_t ch, const Type* input, Type* output, size_t numSamples) noexcept
+    {
+        auto& dline = delayLines[ch];
+        auto& delayTime = delayTimesSample[ch];
+
+        for(size_t i=0; i<numSamples; ++i)
+        {
+            //、delaytimeだけ手前のディレイのサンプルを取得
+            //auto delayedSample = dline.getInterpolated(delayTime);
+            
+            //delaytimeだけ前のディレイのサンプルを取得、ただしLPFにかける
+            auto delayedSample = processLowpassSample(ch, dline.getInterpolated(delayTime.getNextValue()));
+            
+            //現在のサンプルを取得
+            auto inputSample = input[i];
+            //ディレイ信号とinput信号を混ぜ、tanhで変位を0~1に抑え、delaytime後に鳴るようにpush
+            auto dlineInputSample = Saturation<Type>::processSample(inputSample+feedback*delayedSample);
+            dline.push(dlineInputSample);
+            //delay信号をwet率で混ぜる
+            auto outputSample = inputSample + wetLevel * delayedSample;
+            output[i] = outputSample;
+        }
+    }
+
+   #if JUCE_USE_SIMD
+    //==============================================================================
+    /** processSampleBySample for up to SIMDRegister<Type>::size() channels at once. Each lane
+        of a register holds one channel, so the lowpass, mix, feedback and saturation run once
+        per sample for all of them; only the DelayLine reads and writes are done lane by lane.
+        Lanes from numChannels up stay at zero and are never read or written back.
+    */
+    template <typename InputBlock, typename OutputBlock>
+    void processInterleaved (const size_t* channels, size_t numChannels, const InputBlock& inputBlock,
+                             OutputBlock& outputBlock, size_t numSamples) noexcept
+    {
+        using Register = juce::dsp::SIMDRegister<Type>;
+        constexpr auto numLanes = Register::SIMDNumElements;
+
+        jassert(numChannels <= numLanes);
+
+        const Type* inputs[numLanes];
+        Type* outputs[numLanes];
+        alignas (Register::SIMDRegisterSize) Type lanes[numLanes] = {};
+
+        for (size_t lane = 0; lane < numChannels; ++lane)
+        {
+            inputs[lane]  = inputBlock.getChannelPointer(channels[lane]);
+            outputs[lane] = outputBlock.getChannelPointer(channels[lane]);
+        }
+
+        auto feedbackRegister = Register::expand(feedback);
+        auto wetLevelRegister = Register::expand(wetLevel);
+
+        for (size_t lane = 0; lane < numChannels; ++lane)
+            lanes[lane] = lpFilterStates[channels[lane]];
+
+        auto lpState = Register::fromRawArray(lanes);
+
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            //各チャンネルの遅延信号をレーンに並べ、まとめてLPFにかける。空きレーンは0のまま
+            for (size_t lane = 0; lane < numChannels; ++lane)
+            {
+                auto ch = channels[lane];
+                lanes[lane] = delayLines[ch].getInterpolated(delayTimesSample[ch].getNextValue());
+            }
+
+            auto delayedSample = processLowpassSIMD(Register::fromRawArray(lanes), lpState);
+
+            for (size_t lane = 0; lane < numChannels; ++lane)
+                lanes[lane] = inputs[lane][i];
+
+            auto inputSample = Register::fromRawArray(lanes);
+
+            //フィードバックとtanhは全チャンネルまとめて計算し、チャンネルごとにpush
+            Saturation<Type>::processSIMD(inputSample + feedbackRegister * delayedSample).copyToRawArray(lanes);
+
+            for (size_t lane = 0; lane < numChannels; ++lane)
+                delayLines[channels[lane]].push(lanes[lane]);
+
+            (inputSample + wetLevelRegister * delayedSample).copyToRawArray(lanes);
+
+            for (size_t lane = 0; lane < numChannels; ++lane)
+                outputs[lane][i] = lanes[lane];
+        }
+
+        lpState.copyToRawArray(lanes);
+
+        for (size_t lane = 0; lane < numChannels; ++lane)
+            lpFilterStates[channels[lane]] = lanes[lane];
+    }
+   #endif
+
+    //==============================================================================
+    size_t getDelayLineSizeSamples() const noexcept
+    {
+        //補間で参照する前後のサンプル分の余裕を足しておく
+        return (size_t) std::ceil(maxDelayTime*sampleRate) + interpolationHeadroom;
+    }
+
+    //==============================================================================
+    //DelayLineのサンプル数を、Delayのテールの長さに合わせる
+    void updateDelayLineSize() noexcept
+    {
+        auto delayLineSizeSamples = getDelayLineSizeSamples();
+
+        //prepareで確保した容量を超える場合は、次のprepareまで確保済みの長さで我慢する
+        jassert(delayLineCapacity == 0 || delayLineSizeSamples <= delayLineCapacity);
+        delayLineSizeSamples = juce::jmin(delayLineSizeSamples, delayLineCapacity);
+
+        for (auto& dline : delayLines)
+            dline.resize(delayLineSizeSamples);
+    }
+
+    //==============================================================================
+    //増えたチャンネルは、既存の値を順番に使い回した値から始める。確保はprepareの中だけ
+    static void addChannelValues (std::vector<Type>& values, size_t numChannels)
+    {
+        for (auto numExisting = values.size(); values.size() < numChannels;)
+            values.push_back(values[values.size() % numExisting]);
+    }
+
+    //再生中に呼ばれてもアロケーションしないよう、範囲外のチャンネルには書かない
+    static void setChannelValue (std::vector<Type>& values, size_t channel, Type newValue) noexcept
+    {
+        jassert(channel < values.size());
+
+        if (channel < values.size())
+            values[channel] = newValue;
+    }
+
+    //==============================================================================
+    //テンポかサンプルレートか設定が変わった時だけ呼ばれ、サンプル数への変換結果をスムーザーに渡す
+    void updateDelayTime (bool smooth = true) noexcept
+    {
+        auto& times = tempoSync ? delayTimesInBeats : delayTimes;
+
+        //prepare前はチャンネル数が決まっていないので、設定だけ覚えておく
+        if (delayLines.empty() || times.empty())
+            return;
+
+        auto maxDelaySamples = juce::jmax(Type(0), (Type) delayLines[0].size() - (Type) interpolationHeadroom);
+        auto samplesPerUnit = tempoSync ? (Type) (60.0 / bpm) * sampleRate : sampleRate;
+
+        for (size_t ch=0; ch< delayTimesSample.size(); ++ch)
+        {
+            auto newValue = juce::jmin(times[ch % times.size()]*samplesPerUnit, maxDelaySamples);
+
+            if (smooth)
+                delayTimesSample[ch].setTargetValue(newValue);
+            else
+                delayTimesSample[ch].setCurrentAndTargetValue(newValue);
+        }
+    }
+};
+
+//==============================================================================
+/** A delay with up to maxNumTaps read taps on one DelayLine per channel.
+
+    Every tap has its own delay time, gain, pan and one-pole lowpass, but all taps of a
+    channel read the same buffer, so memory does not grow with the number of taps. Blocks
+    read every tap of a sample together in one pass over the buffer. The
+    sum of the filtered taps is fed back into the line; in ping-pong mode it is fed into
+    the other line of the channel pair instead (L <-> R), so the echoes bounce between them.
+*/
+template <typename Type,
+          template <typename> class Interpolation = DelayLineInterpolation::Lagrange3rd,
+          template <typename> class Saturation = FastTanh>
+class MultiTapDelay
+{
+public:
+    static constexpr size_t maxNumTaps = 16;
+
+    //==============================================================================
+    MultiTapDelay()
+    {
+        setMaxDelayTime(2.0f);
+        setWetLevel(0.8f);
+        setFeedback(0.3f);
+
+        for (size_t tap = 0; tap < maxNumTaps; ++tap)
+            setTapDelayTime(tap, 0.125f * Type (tap + 1));
+    }
+
+    //==============================================================================
+    void prepare (const juce::dsp::ProcessSpec& spec)
+    {
+        jassert(spec.numChannels > 0);
+        sampleRate = (Type) spec.sampleRate;
+
+        auto numChannels = (size_t) spec.numChannels;
+        delayLines.resize(numChannels);
+        tapFilterStates.assign(numChannels * maxNumTaps, Type(0));
+        tapChannelGains.assign(numChannels * maxNumTaps, Type(0));
+        inputSamples.resize(numChannels);
+        feedbackSamples.resize(numChannels);
+
+        //再生中にアロケーションしないように、最大遅延時間分のメモリはここで確保しておく
+        delayLineCapacity = getDelayLineSizeSamples();
+
+        for (auto& dline : delayLines)
+            dline.reserve(delayLineCapacity);
+
+        updateDelayLineSize();
+
+        for (auto& dt : tapDelayTimesSample)
+            dt.reset(spec.sampleRate, delayTimeRampSeconds);
+
+        updateTapDelayTimes(false);
+        updateTapGains();
+        updateTapFilters();
+
+        //チャンネルごとのwet信号とフィードバック信号、DelayLineへの入力信号
+        scratchBlock = juce::dsp::AudioBlock<Type> (heapBlock, 2 * numChannels + 1, spec.maximumBlockSize);
+    }
+
+    //==============================================================================
+    void reset() noexcept
+    {
+        std::fill(tapFilterStates.begin(), tapFilterStates.end(), Type(0));
+
+        for (auto& dline : delayLines)
+            dline.clear();
+    }
+
+    //==============================================================================
+    size_t getNumChannels() const noexcept
+    {
+        return delayLines.size();
+    }
+
+    //==============================================================================
+    void setMaxDelayTime (Type newValue)
+    {
+        jassert(newValue > Type(0));
+        maxDelayTime = newValue;
+        updateDelayLineSize();
+        updateTapDelayTimes();
+    }
+
+    void setFeedback (Type newValue) noexcept
+    {
+        jassert (newValue >= Type (0) && newValue <= Type (1));
+        feedback = newValue;
+    }
+
+    void setWetLevel (Type newValue) noexcept
+    {
+        jassert (newValue >= Type (0) && newValue <= Type (1));
+        wetLevel = newValue;
+    }
+
+    /** In ping-pong mode the feedback of each channel goes into its neighbour's line */
+    void setPingPong (bool shouldPingPong) noexcept
+    {
+        pingPong = shouldPingPong;
+    }
+
+    //==============================================================================
+    /** Sets how many of the taps are used, from 1 to maxNumTaps */
+    void setNumTaps (size_t newNumTaps) noexcept
+    {
+        jassert(newNumTaps > 0 && newNumTaps <= maxNumTaps);
+        numTaps = juce::jlimit((size_t) 1, maxNumTaps, newNumTaps);
+    }
+
+    void setTapDelayTime (size_t tap, Type newValue)
+    {
+        jassert(tap < maxNumTaps && newValue >= Type(0));
+        taps[tap].delayTime = newValue;
+        updateTapDelayTimes();
+    }
+
+    void setTapGain (size_t tap, Type newValue) noexcept
+    {
+        jassert(tap < maxNumTaps);
+        taps[tap].gain = newValue;
+        updateTapGains();
+    }
+
+    /** -1 is fully left, 1 is fully right. Only used when there are two channels */
+    void setTapPan (size_t tap, Type newValue) noexcept
+    {
+        jassert(tap < maxNumTaps && newValue >= Type(-1) && newValue <= Type(1));
+        taps[tap].pan = newValue;
+        updateTapGains();
+    }
+
+    void setTapCutoffFrequency (size_t tap, Type newValue) noexcept
+    {
+        jassert(tap < maxNumTaps && newValue > Type(0));
+        taps[tap].cutoffFrequency = newValue;
+        updateTapFilters();
+    }
+
+    //==============================================================================
+    template <typename ProcessContext>
+    void process (const ProcessContext& context) noexcept
+    {
+        auto& inputBlock = context.getInputBlock();
+        auto& outputBlock = context.getOutputBlock();
+        auto numSamples = outputBlock.getNumSamples();
+
+        jassert(inputBlock.getNumSamples() == numSamples);
+        jassert(inputBlock.getNumChannels() == outputBlock.getNumChannels());
+        jassert(outputBlock.getNumChannels() == getNumChannels());
+
+        if (context.isBypassed)
+        {
+            if (context.usesSeparateInputAndOutputBlocks())
+                outputBlock.copyFrom (inputBlock);
+
+            return;
+        }
+
+        //一番短いタップでもブロック長以上遅れていれば、このブロックで書き込むサンプルは読まない
+        auto canProcessBlockwise = true;
+
+        for (size_t tap = 0; tap < numTaps; ++tap)
+        {
+            auto& delayTime = tapDelayTimesSample[tap];
+            canProcessBlockwise = canProcessBlockwise && ! delayTime.isSmoothing()
+                                    && delayTime.getCurrentValue() >= (Type) numSamples;
+        }
+
+        if (canProcessBlockwise)
+            processBlockwise(inputBlock, outputBlock, numSamples);
+        else
+            processSampleBySample(inputBlock, outputBlock, numSamples);
+    }
+
+private:
+    //==============================================================================
+    struct Tap
+    {
+        Type delayTime { Type (0) };
+        Type gain { Type (0.5) };
+        Type pan { Type (0) };
+        Type cutoffFrequency { Type (8e3) };
+    };
+
+    std::array<Tap, maxNumTaps> taps;
+    std::array<juce::SmoothedValue<Type>, maxNumTaps> tapDelayTimesSample;
+    std::array<Type, maxNumTaps> tapFilterCoefs;
+    size_t numTaps { 4 };
+
+    std::vector<DelayLine<Type, Interpolation>> delayLines;
+    //[チャンネル * maxNumTaps + タップ] の順に並べる
+    std::vector<Type> tapFilterStates, tapChannelGains;
+    std::vector<Type> inputSamples, feedbackSamples;
+
+    Type feedback { Type (0) };
+    Type wetLevel { Type (0) };
+    bool pingPong { false };
+
+    juce::HeapBlock<char> heapBlock;
+    juce::dsp::AudioBlock<Type> scratchBlock;
+
+    Type sampleRate   { Type (44.1e3) };
+    Type maxDelayTime { Type (2) };
+    size_t delayLineCapacity { 0 };
+
+    static constexpr size_t interpolationHeadroom = 4;
+    static constexpr double delayTimeRampSeconds = 0.1;
+
+    //==============================================================================
+    //フィードバック信号をどのチャンネルのラインに戻すか
+    size_t getFeedbackDestination (size_t ch) const noexcept
+    {
+        if (pingPong && (ch ^ 1) < getNumChannels())
+            return ch ^ 1;
+
+        return ch;
+    }
+
+    Type processTapFilterSample (size_t stateIndex, size_t tap, Type x) noexcept
+    {
+        auto& state = tapFilterStates[stateIndex];
+        state += tapFilterCoefs[tap] * (x - state);
+        return state;
+    }
+
+    //==============================================================================
+    template <typename InputBlock, typename OutputBlock>
+    void processBlockwise (const InputBlock& inputBlock, OutputBlock& outputBlock, size_t numSamples) noexcept
+    {
+        auto numChannels = getNumChannels();
+        std::array<Type, maxNumTaps> tapDelays;
+
+        for (size_t tap = 0; tap < numTaps; ++tap)
+            tapDelays[tap] = tapDelayTimesSample[tap].getCurrentValue();
+
+        //タップごとにラインを読み直さず、サンプルごとに全タップを読んでwet信号とフィードバック信号にまとめる
+        for (size_t ch = 0; ch < numChannels; ++ch)
+        {
+            auto& dline = delayLines[ch];
+            auto* states = tapFilterStates.data() + ch * maxNumTaps;
+            auto* channelGains = tapChannelGains.data() + ch * maxNumTaps;
+            auto* wet = scratchBlock.getChannelPointer(ch);
+            //フィードバックの行き先は一対一なので、足し込まずに書くだけでいい
+            auto* feedbackSum = scratchBlock.getChannelPointer(getFeedbackDestination(ch) + numChannels);
+
+            for (size_t i = 0; i < numSamples; ++i)
+            {
+                auto wetSample = Type(0);
+                auto feedbackSample = Type(0);
+
+                for (size_t tap = 0; tap < numTaps; ++tap)
+                {
+                    auto& state = states[tap];
+                    state += tapFilterCoefs[tap] * (dline.getInBlock(tapDelays[tap], i) - state);
+
+                    wetSample += channelGains[tap] * state;
+                    feedbackSample += taps[tap].gain * state;
+                }
+
+                wet[i] = wetSample;
+                feedbackSum[i] = feedbackSample;
+            }
+        }
+
+        //全チャンネル分読み終わってから書き込む（ピンポンでは隣のラインに書くため）
+        auto* dlineInput = scratchBlock.getChannelPointer(2 * numChannels);
+
+        for (size_t ch = 0; ch < numChannels; ++ch)
+        {
+            auto* input = inputBlock.getChannelPointer(ch);
+            auto* output = outputBlock.getChannelPointer(ch);
+
+            juce::FloatVectorOperations::copy(dlineInput, input, (int) numSamples);
+            juce::FloatVectorOperations::addWithMultiply(dlineInput, scratchBlock.getChannelPointer(ch + numChannels), feedback, (int) numSamples);
+
+            Saturation<Type>::process(dlineInput, numSamples);
+            delayLines[ch].writeBlock(dlineInput, numSamples);
+
+            if (output != input)
+                juce::FloatVectorOperations::copy(output, input, (int) numSamples);
+
+            juce::FloatVectorOperations::addWithMultiply(output, scratchBlock.getChannelPointer(ch), wetLevel, (int) numSamples);
+        }
+    }
+
+    //==============================================================================
+    template <typename InputBlock, typename OutputBlock>
+    void processSampleBySample (const InputBlock& inputBlock, OutputBlock& outputBlock, size_t numSamples) noexcept
+    {
+        auto numChannels = getNumChannels();
+        std::array<Type, maxNumTaps> tapDelays;
+
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            for (size_t tap = 0; tap < numTaps; ++tap)
+                tapDelays[tap] = tapDelayTimesSample[tap].getNextValue();
+
+            std::fill(feedbackSamples.begin(), feedbackSamples.end(), Type(0));
+
+            for (size_t ch = 0; ch < numChannels; ++ch)
+            {
+                auto wet = Type(0);
+                auto feedbackSum = Type(0);
+
+                for (size_t tap = 0; tap < numTaps; ++tap)
+                {
+                    auto stateIndex = ch * maxNumTaps + tap;
+                    auto tapSample = processTapFilterSample(stateIndex, tap, delayLines[ch].getInterpolated(tapDelays[tap]));
+
+                    wet += tapChannelGains[stateIndex] * tapSample;
+                    feedbackSum += taps[tap].gain * tapSample;
+                }
+
+                feedbackSamples[getFeedbackDestination(ch)] += feedbackSum;
+
+                //inputとoutputが同じバッファの場合があるので、pushする前に入力を取っておく
+                inputSamples[ch] = inputBlock.getChannelPointer(ch)[i];
+                outputBlock.getChannelPointer(ch)[i] = inputSamples[ch] + wetLevel * wet;
+            }
+
+            for (size_t ch = 0; ch < numChannels; ++ch)
+                delayLines[ch].push(Saturation<Type>::processSample(inputSamples[ch] + feedback * feedbackSamples[ch]));
+        }
+    }
+
+    //==============================================================================
+    size_t getDelayLineSizeSamples() const noexcept
+    {
+        return (size_t) std::ceil(maxDelayTime*sampleRate) + interpolationHeadroom;
+    }
+
+    void updateDelayLineSize() noexcept
+    {
+        auto delayLineSizeSamples = getDelayLineSizeSamples();
+
+        jassert(delayLineCapacity == 0 || delayLineSizeSamples <= delayLineCapacity);
+        delayLineSizeSamples = juce::jmin(delayLineSizeSamples, delayLineCapacity);
+
+        for (auto& dline : delayLines)
+            dline.resize(delayLineSizeSamples);
+    }
+
+    void updateTapDelayTimes (bool smooth = true) noexcept
+    {
+        if (delayLines.empty())
+            return;
+
+        auto maxDelaySamples = juce::jmax(Type(0), (Type) delayLines[0].size() - (Type) interpolationHeadroom);
+
+        for (size_t tap = 0; tap < maxNumTaps; ++tap)
+        {
+            auto newValue = juce::jmin(taps[tap].delayTime*sampleRate, maxDelaySamples);
+
+            if (smooth)
+                tapDelayTimesSample[tap].setTargetValue(newValue);
+            else
+                tapDelayTimesSample[tap].setCurrentAndTargetValue(newValue);
+        }
+    }
+
+    //ゲインとパンから、タップごと・チャンネルごとの出力ゲインを計算しておく
+    void updateTapGains() noexcept
+    {
+        auto numChannels = getNumChannels();
+
+        for (size_t ch = 0; ch < numChannels; ++ch)
+        {
+            for (size_t tap = 0; tap < maxNumTaps; ++tap)
+            {
+                auto& tapSettings = taps[tap];
+                auto panGain = Type(1);
+
+                //ステレオの時だけバランスとしてパンをかける
+                if (numChannels == 2)
+                    panGain = ch == 0 ? juce::jmin(Type(1), Type(1) - tapSettings.pan)
+                                      : juce::jmin(Type(1), Type(1) + tapSettings.pan);
+
+                tapChannelGains[ch * maxNumTaps + tap] = tapSettings.gain * panGain;
+            }
+        }
+    }
+
+    void updateTapFilters() noexcept
+    {
+        for (size_t tap = 0; tap < maxNumTaps; ++tap)
+        {
+            auto cutoff = juce::jmin(taps[tap].cutoffFrequency, sampleRate * Type(0.49));
+            tapFilterCoefs[tap] = Type(1) - std::exp(-juce::MathConstants<Type>::twoPi * cutoff / sampleRate);
+        }
+    }
+};
+
+//==============================================================================
+/** Pre-gain into a tanh waveshaper. WaveShaper is OversampledWaveShaper by default; an
+    ADAAWaveShaper can be put in its place for a cheaper way of reducing aliasing.
+*/
+template <typename Type,
+          template <typename> class Saturation = FastTanh,
+          typename WaveShaper = OversampledWaveShaper<Type, Saturation>>
+class Distortion
+{
+public:
+    //==============================================================================
+    Distortion()
+    {
+        auto& preGain = processorChain.template get<preGainIndex>();
+        preGain.setGainDecibels (30.0f);
+
+        auto& postGain = processorChain.template get<postGainIndex>();
+        postGain.setGainDecibels (0.0f);
+    }
+
+    //==============================================================================
+    void prepare (const juce::dsp::ProcessSpec& spec)
+    {
+        auto& filter = processorChain.template get<filterIndex>();
+        filter.state = FilterCoefs::makeFirstOrderHighPass (spec.sampleRate, 1000.0f);
+
+        processorChain.prepare (spec);
+    }
+
+    //==============================================================================
+    template <typename ProcessContext>
+    void process (const ProcessContext& context) noexcept
+    {
+        processorChain.process (context);
+    }
+
+    //==============================================================================
+    void reset() noexcept
+    {
+        processorChain.reset();
+    }
+
+    //==============================================================================
+    using OversamplingFilter = typename OversampledWaveShaper<Type, Saturation>::FilterType;
+
+    /** Oversamples the waveshaper 2^factorLog2 times (0 = off, up to 8x). Call prepare() afterwards.
+        Only available with OversampledWaveShaper.
+    */
+    void setOversampling (size_t factorLog2, OversamplingFilter filterType = OversamplingFilter::polyphaseIIR)
+    {
+        processorChain.template get<waveshaperIndex>().setOversampling (factorLog2, filterType);
+    }
+
+    Type getLatencyInSamples() const noexcept
+    {
+        return processorChain.template get<waveshaperIndex>().getLatencyInSamples();
+    }
+
+private:
+    //==============================================================================
+    enum
+    {
+        filterIndex,
+        preGainIndex,
+        waveshaperIndex,
+        postGainIndex
+    };
+
+    using Filter = juce::dsp::IIR::Filter<Type>;
+    using FilterCoefs = juce::dsp::IIR::Coefficients<Type>;
+
+    juce::dsp::ProcessorChain<juce::dsp::ProcessorDuplicator<Filter, FilterCoefs>,
+                              juce::dsp::Gain<Type>, WaveShaper, juce::dsp::Gain<Type>> processorChain;
+};
+
+//==============================================================================
+/** The triangular pluck that WaveguideStringBank::trigger puts on a string.
+
+    Instead of writing the whole period into the delay lines at note-on, the pluck is
+    written lazily: for the first period after the trigger, each sample fills in only the
+    few positions that are about to be read. A note-on then costs the same at any pitch.
+    Sample j of the pluck is the one that was j samples old at the time of the trigger.
+*/
+template <typename Type>
+struct PendingPluck
+{
+    void start (size_t newLength, size_t newTriggerIndex, Type newVelocity) noexcept
+    {
+        length = newLength;
+        triggerIndex = newTriggerIndex;
+        velocity = newVelocity;
+        age = 0;
+        pending = true;
+    }
+
+    /** True while samples written before the trigger can still be read */
+    bool isPending() const noexcept     { return pending; }
+
+    /** Call once per sample, after the reads */
+    void advance() noexcept
+    {
+        //読み出しは最大でも length + 1 サンプル前までなので、それを過ぎたら終わり
+        pending = pending && ++age <= length + 1;
+    }
+
+    /** If the sample delayInSamples behind the newest one still belongs to the pluck, calls
+        write (forwardValue, backwardValue) with what the line should hold there.
+    */
+    template <typename WriteFunction>
+    void fill (size_t delayInSamples, WriteFunction write) const noexcept
+    {
+        if (pending && delayInSamples >= age)
+        {
+            auto j = delayInSamples - age;
+            write (getForwardValue (j), j < length ? getForwardValue (length - 1 - j) : Type (0));
+        }
+    }
+
+private:
+    size_t length = 0, triggerIndex = 0, age = 0;
+    Type velocity = Type (0);
+    bool pending = false;
+
+    //両端を0、triggerIndexを頂点とした山型。backwardはこれを左右反転したもの
+    Type getForwardValue (size_t j) const noexcept
+    {
+        if (j >= length)
+            return Type (0);
+
+        if (j < triggerIndex)
+            return juce::jmap (Type (j), Type (0), Type (triggerIndex), Type (0), velocity / 2);
+
+        return juce::jmap (Type (j), Type (triggerIndex), Type (juce::jmax (length - 1, triggerIndex + 1)), velocity / 2, Type (0));
+    }
+};
+
+//==============================================================================
+/** A set of waveguide strings stored as structure-of-arrays, so that
+    SIMDRegister<Type>::size() strings advance together.
+
+    Each string is a pair of delay lines (forward and backward travelling waves) with
+    inverting reflections at both ends; the reflection into the backward line goes
+    through a one-pole lowpass and the decay coefficient. The fractional part of the
+    loop length is interpolated with a first-order Thiran allpass.
+
+    All strings share one write position: sample k of string s is stored at row k,
+    column s. Each push is then a single aligned register store per line, and only the
+    reads, whose delays differ from string to string, are gathered lane by lane.
+    AudioEngine renders the whole bank once per sub-block, before the voices run.
+*/
+template <typename Type>
+class WaveguideStringBank
+{
+public:
+    //==============================================================================
+    void prepare (const juce::dsp::ProcessSpec& spec, size_t numStringsToUse)
+    {
+        jassert (numStringsToUse > 0);
+        sampleRateHz = (Type) spec.sampleRate;
+        numStrings = numStringsToUse;
+        numLanes = (numStrings + laneWidth - 1) / laneWidth * laneWidth;
+
+        //一番低い音の長さ分を、全ての弦の分まとめて確保する
+        auto maxLength = (size_t) std::ceil (sampleRateHz / lowestFrequency()) + 2;
+        auto capacity = (size_t) juce::nextPowerOfTwo ((int) maxLength);
+        mask = capacity - 1;
+
+        forwardData  = allocateAligned (forwardStorage,  capacity * numLanes);
+        backwardData = allocateAligned (backwardStorage, capacity * numLanes);
+        laneData     = allocateAligned (laneStorage, numLaneParameters * numLanes);
+
+        readIndices.assign (numLanes, 0);
+        forwardPickupIndices.assign (numLanes, 0);
+        backwardPickupIndices.assign (numLanes, 0);
+        strings.resize (numLanes);
+
+        outputBlock = juce::dsp::AudioBlock<Type> (heapBlock, numLanes, spec.maximumBlockSize);
+
+        for (size_t s = 0; s < numLanes; ++s)
+            updateParameters (s);
+
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        std::fill (forwardStorage.begin(), forwardStorage.end(), Type (0));
+        std::fill (backwardStorage.begin(), backwardStorage.end(), Type (0));
+
+        for (auto p : { lpStateIndex, forwardLastIndex, backwardLastIndex })
+            std::fill (getLaneParameter (p), getLaneParameter (p) + numLanes, Type (0));
+
+        for (auto& string : strings)
+            string.active = false;
+
+        writeIndex = 0;
+        numRenderedSamples = 0;
+    }
+
+    size_t getNumStrings() const noexcept   { return numStrings; }
+
+    /** The lowest pitch the delay lines are allocated for: MIDI note 0 (8.18 Hz) bent down
+        by two semitones, the usual pitch-bend range outside MPE.
+    */
+    static constexpr Type lowestFrequency() noexcept { return Type (7.28); }
+
+    //==============================================================================
+    /** Retunes one string. Frequencies below lowestFrequency(), which only MPE pitch bends
+        of more than two semitones under note 0 can reach, are clamped to it, so that the
+        delay lines allocated in prepare() are always long enough.
+    */
+    void setFrequency (size_t stringIndex, Type newValueHz) noexcept
+    {
+        if (isValidString (stringIndex))
+        {
+            strings[stringIndex].freqHz = juce::jmax (newValueHz, lowestFrequency());
+            updateParameters (stringIndex);
+        }
+    }
+
+    void setPickupPosition (size_t stringIndex, Type newValue) noexcept
+    {
+        jassert (newValue >= Type (0) && newValue <= Type (1));
+
+        if (isValidString (stringIndex))
+        {
+            strings[stringIndex].pickupPos = newValue;
+            updateParameters (stringIndex);
+        }
+    }
+
+    void setTriggerPosition (size_t stringIndex, Type newValue) noexcept
+    {
+        jassert (newValue >= Type (0) && newValue <= Type (1));
+
+        if (isValidString (stringIndex))
+        {
+            strings[stringIndex].triggerPos = newValue;
+            updateParameters (stringIndex);
+        }
+    }
+
+    void setDecayTime (size_t stringIndex, Type newValue) noexcept
+    {
+        jassert (newValue >= Type (0) && newValue <= Type (1));
+
+        if (isValidString (stringIndex))
+        {
+            strings[stringIndex].decayTime = newValue;
+            updateParameters (stringIndex);
+        }
+    }
+
+    //==============================================================================
+    /** Plucks one string at its trigger position. Costs the same at any pitch (see PendingPluck). */
+    void trigger (size_t stringIndex, Type velocity) noexcept
+    {
+        jassert (velocity >= Type (0) && velocity <= Type (1));
+
+        if (! isValidString (stringIndex))
+            return;
+
+        auto& string = strings[stringIndex];
+
+        //一周期分を一度に書くとノートオンのコストが音程に比例するので、山型は最初の一周期の間に読む直前の位置だけ書く
+        string.pluck.start (string.length, string.triggerIndex, velocity);
+
+        getLaneParameter (forwardLastIndex)[stringIndex] = Type (0);
+        getLaneParameter (backwardLastIndex)[stringIndex] = Type (0);
+        string.active = true;
+    }
+
+    /** False once the string has been stopped or has decayed to exact silence */
+    bool isActive (size_t stringIndex) const noexcept
+    {
+        return isValidString (stringIndex) && strings[stringIndex].active;
+    }
+
+    /** Stops rendering a string that is no longer audible, until it is triggered again */
+    void stop (size_t stringIndex) noexcept
+    {
+        if (! isValidString (stringIndex))
+            return;
+
+        //残っているフィルタの状態が次のトリガーに混ざらないようにする
+        getLaneParameter (lpStateIndex)[stringIndex] = Type (0);
+        strings[stringIndex].active = false;
+    }
+
+    //==============================================================================
+    /** Renders numSamples of every sounding string. The result stays available through
+        getOutput() until the next call.
+    */
+    void process (size_t numSamples) noexcept
+    {
+        jassert (numSamples <= outputBlock.getNumSamples());
+
+       #if JUCE_USE_SIMD
+        for (size_t firstString = 0; firstString < numLanes; firstString += laneWidth)
+            processGroup (firstString, numSamples);
+       #else
+        for (size_t s = 0; s < numLanes; ++s)
+            processString (s, numSamples);
+       #endif
+
+        writeIndex = (writeIndex + numSamples) & mask;
+        numRenderedSamples = numSamples;
+
+        //出力が完全に0になった弦は、次のトリガーまで計算しない
+        for (size_t s = 0; s < numStrings; ++s)
+        {
+            if (strings[s].active)
+            {
+                auto* output = outputBlock.getChannelPointer (s);
+                strings[s].active = std::any_of (output, output + numSamples, [] (Type x) { return x != Type (0); });
+            }
+        }
+    }
+
+    const Type* getOutput (size_t stringIndex) const noexcept   { return outputBlock.getChannelPointer (stringIndex); }
+    size_t getNumRenderedSamples() const noexcept               { return numRenderedSamples; }
+
+private:
+    //==============================================================================
+    struct StringSettings
+    {
+        Type freqHz     { lowestFrequency() };
+        Type pickupPos  { Type (0.8) };
+        Type triggerPos { Type (0.2) };
+        Type decayTime  { Type (0.5) };
+
+        size_t length       { 1 };
+        size_t triggerIndex { 0 };
+        bool active         { false };
+
+        PendingPluck<Type> pluck;
+    };
+
+    //レーンごとのパラメータと状態を、パラメータごとに numLanes 個ずつ並べる
+    enum
+    {
+        alphaIndex,
+        negativeDecayIndex,
+        lpB0Index,
+        lpB1Index,
+        lpA1Index,
+        lpStateIndex,
+        forwardLastIndex,
+        backwardLastIndex,
+        numLaneParameters
+    };
+
+   #if JUCE_USE_SIMD
+    static constexpr size_t laneWidth = juce::dsp::SIMDRegister<Type>::SIMDNumElements;
+   #else
+    static constexpr size_t laneWidth = 1;
+   #endif
+
+    std::vector<Type> forwardStorage, backwardStorage, laneStorage;
+    Type* forwardData  = nullptr;
+    Type* backwardData = nullptr;
+    Type* laneData     = nullptr;
+
+    std::vector<size_t> readIndices, forwardPickupIndices, backwardPickupIndices;
+    std::vector<StringSettings> strings;
+
+    juce::HeapBlock<char> heapBlock;
+    juce::dsp::AudioBlock<Type> outputBlock;
+
+    Type sampleRateHz { Type (44.1e3) };
+    size_t numStrings = 0, numLanes = 0;
+    size_t mask = 0, writeIndex = 0, numRenderedSamples = 0;
+
+    //==============================================================================
+    static Type* allocateAligned (std::vector<Type>& storage, size_t size)
+    {
+        storage.assign (size + laneWidth, Type (0));
+
+       #if JUCE_USE_SIMD
+        return juce::dsp::SIMDRegister<Type>::getNextSIMDAlignedPtr (storage.data());
+       #else
+        return storage.data();
+       #endif
+    }
+
+    bool isValidString (size_t stringIndex) const noexcept
+    {
+        jassert (stringIndex < numStrings);
+        return stringIndex < numStrings;
+    }
+
+    Type* getLaneParameter (size_t parameterIndex) const noexcept
+    {
+        return laneData + parameterIndex * numLanes;
+    }
+
+    //DelayLine::get と同じく、row を最新として delayInSamples 戻った位置
+    Type& getSample (Type* data, size_t stringIndex, size_t row, size_t delayInSamples) const noexcept
+    {
+        return data[((row - delayInSamples) & mask) * numLanes + stringIndex];
+    }
+
+    //このサンプルで読む位置のうち、まだトリガー前の領域にあるものに山型の値を書いておく。row は push 前の最新の行
+    void fillPluckedSamples (size_t s, size_t row) noexcept
+    {
+        auto& pluck = strings[s].pluck;
+
+        auto writeBoth = [this, s, row, &pluck] (size_t delay)
+        {
+            pluck.fill (delay, [this, s, row, delay] (Type forwardValue, Type backwardValue)
+            {
+                getSample (forwardData, s, row, delay) = forwardValue;
+                getSample (backwardData, s, row, delay) = backwardValue;
+            });
+        };
+
+        writeBoth (readIndices[s]);
+        writeBoth (readIndices[s] + 1);
+
+        if (forwardPickupIndices[s] > 0)
+            writeBoth (forwardPickupIndices[s] - 1);
+
+        if (backwardPickupIndices[s] > 0)
+            writeBoth (backwardPickupIndices[s] - 1);
+    }
+
+    //==============================================================================
+    //ノートオンのたびにオーディオスレッドから呼ばれるので、アロケーションせず弦ごとの配列に書き込む
+    void updateParameters (size_t s) noexcept
+    {
+        auto& string = strings[s];
+
+        auto loopDelay = sampleRateHz / string.freqHz;
+        auto length = (size_t) juce::roundToInt (loopDelay);
+        string.length = length;
+
+        forwardPickupIndices[s] = (size_t) juce::roundToInt (juce::jmap (string.pickupPos, Type (0), Type (length / 2 - 1)));
+        backwardPickupIndices[s] = length - 1 - forwardPickupIndices[s];
+        string.triggerIndex = (size_t) juce::roundToInt (juce::jmap (string.triggerPos, Type (0), Type (length / 2 - 1)));
+
+        auto n = std::tan (juce::MathConstants<Type>::pi * 4 * string.freqHz / sampleRateHz);
+        getLaneParameter (lpB0Index)[s] = n / (n + 1);
+        getLaneParameter (lpB1Index)[s] = n / (n + 1);
+        getLaneParameter (lpA1Index)[s] = (n - 1) / (n + 1);
+
+        getLaneParameter (negativeDecayIndex)[s] = -juce::jmap (string.decayTime, std::pow (Type (0.999), loopDelay),
+                                                                                  std::pow (Type (0.99999), loopDelay));
+
+        //DelayLineInterpolation::Thiran で loopDelay - 1 を読むときの整数部と係数
+        auto delay = loopDelay - Type (1);
+        auto delayInt = (size_t) delay;
+        auto delayFrac = delay - (Type) delayInt;
+
+        if (delayFrac < Type (0.618) && delayInt >= 1)
+        {
+            --delayInt;
+            delayFrac += Type (1);
+        }
+
+        readIndices[s] = delayInt;
+        getLaneParameter (alphaIndex)[s] = (Type (1) - delayFrac) / (Type (1) + delayFrac);
+    }
+
+   #if JUCE_USE_SIMD
+    //==============================================================================
+    void processGroup (size_t firstString, size_t numSamples) noexcept
+    {
+        using Register = juce::dsp::SIMDRegister<Type>;
+
+        auto anyActive = false;
+
+        for (size_t lane = 0; lane < laneWidth; ++lane)
+            anyActive = anyActive || strings[firstString + lane].active;
+
+        if (! anyActive)
+        {
+            for (size_t lane = 0; lane < laneWidth; ++lane)
+                juce::FloatVectorOperations::clear (outputBlock.getChannelPointer (firstString + lane), (int) numSamples);
+
+            return;
+        }
+
+        auto loadLanes = [this, firstString] (size_t p) { return Register::fromRawArray (getLaneParameter (p) + firstString); };
+
+        auto alpha = loadLanes (alphaIndex);
+        auto negativeDecay = loadLanes (negativeDecayIndex);
+        auto b0 = loadLanes (lpB0Index);
+        auto b1 = loadLanes (lpB1Index);
+        auto a1 = loadLanes (lpA1Index);
+        auto lpState = loadLanes (lpStateIndex);
+        auto forwardLast = loadLanes (forwardLastIndex);
+        auto backwardLast = loadLanes (backwardLastIndex);
+        auto zero = Register::expand (Type (0));
+
+        Type* outputs[laneWidth];
+        const size_t* readIndex = readIndices.data() + firstString;
+        const size_t* forwardPickup = forwardPickupIndices.data() + firstString;
+        const size_t* backwardPickup = backwardPickupIndices.data() + firstString;
+
+        alignas (Register::SIMDRegisterSize) Type forward1[laneWidth], forward2[laneWidth], backward1[laneWidth], backward2[laneWidth];
+
+        for (size_t lane = 0; lane < laneWidth; ++lane)
+            outputs[lane] = outputBlock.getChannelPointer (firstString + lane);
+
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            auto row = writeIndex + i;
+
+            for (size_t lane = 0; lane < laneWidth; ++lane)
+            {
+                if (strings[firstString + lane].pluck.isPending())
+                {
+                    fillPluckedSamples (firstString + lane, row);
+                    strings[firstString + lane].pluck.advance();
+                }
+            }
+
+            //遅延量は弦ごとに違うので、読み出しだけはレーンごとに集める
+            for (size_t lane = 0; lane < laneWidth; ++lane)
+            {
+                auto column = firstString + lane;
+                forward1[lane]  = forwardData [((row - readIndex[lane])     & mask) * numLanes + column];
+                forward2[lane]  = forwardData [((row - readIndex[lane] - 1) & mask) * numLanes + column];
+                backward1[lane] = backwardData[((row - readIndex[lane])     & mask) * numLanes + column];
+                backward2[lane] = backwardData[((row - readIndex[lane] - 1) & mask) * numLanes + column];
+            }
+
+            //Thiranの全域通過補間
+            forwardLast  = Register::fromRawArray (forward2)  + alpha * (Register::fromRawArray (forward1)  - forwardLast);
+            backwardLast = Register::fromRawArray (backward2) + alpha * (Register::fromRawArray (backward1) - backwardLast);
+
+            auto lowpassed = forwardLast * b0 + lpState;
+            lpState = forwardLast * b1 - lowpassed * a1;
+
+            //固定端反射。書き込みは全レーン同じ行なので、そのままレジスタを書き出す
+            auto newRow = ((row + 1) & mask) * numLanes + firstString;
+            (zero - backwardLast).copyToRawArray (forwardData + newRow);
+            (lowpassed * negativeDecay).copyToRawArray (backwardData + newRow);
+
+            for (size_t lane = 0; lane < laneWidth; ++lane)
+            {
+                auto column = firstString + lane;
+                outputs[lane][i] = forwardData [((row + 1 - forwardPickup[lane])  & mask) * numLanes + column]
+                                 + backwardData[((row + 1 - backwardPickup[lane]) & mask) * numLanes + column];
+            }
+        }
+
+        lpState.copyToRawArray (getLaneParameter (lpStateIndex) + firstString);
+        forwardLast.copyToRawArray (getLaneParameter (forwardLastIndex) + firstString);
+        backwardLast.copyToRawArray (getLaneParameter (backwardLastIndex) + firstString);
+    }
+   #else
+    //==============================================================================
+    void processString (size_t s, size_t numSamples) noexcept
+    {
+        auto* output = outputBlock.getChannelPointer (s);
+
+        if (! strings[s].active)
+        {
+            juce::FloatVectorOperations::clear (output, (int) numSamples);
+            return;
+        }
+
+        auto alpha = getLaneParameter (alphaIndex)[s];
+        auto negativeDecay = getLaneParameter (negativeDecayIndex)[s];
+        auto b0 = getLaneParameter (lpB0Index)[s];
+        auto b1 = getLaneParameter (lpB1Index)[s];
+        auto a1 = getLaneParameter (lpA1Index)[s];
+        auto& lpState = getLaneParameter (lpStateIndex)[s];
+        auto& forwardLast = getLaneParameter (forwardLastIndex)[s];
+        auto& backwardLast = getLaneParameter (backwardLastIndex)[s];
+
+        auto& pluck = strings[s].pluck;
+
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            auto row = writeIndex + i;
+
+            if (pluck.isPending())
+            {
+                fillPluckedSamples (s, row);
+                pluck.advance();
+            }
+
+            forwardLast  = forwardData [((row - readIndices[s] - 1) & mask) * numLanes + s]
+                         + alpha * (forwardData [((row - readIndices[s]) & mask) * numLanes + s] - forwardLast);
+            backwardLast = backwardData[((row - readIndices[s] - 1) & mask) * numLanes + s]
+                         + alpha * (backwardData[((row - readIndices[s]) & mask) * numLanes + s] - backwardLast);
+
+            auto lowpassed = b0 * forwardLast + lpState;
+            lpState = b1 * forwardLast - a1 * lowpassed;
+
+            auto newRow = ((row + 1) & mask) * numLanes + s;
+            forwardData[newRow] = -backwardLast;
+            backwardData[newRow] = negativeDecay * lowpassed;
+
+            output[i] = forwardData [((row + 1 - forwardPickupIndices[s])  & mask) * numLanes + s]
+                      + backwardData[((row + 1 - backwardPickupIndices[s]) & mask) * numLanes + s];
+        }
+    }
+   #endif
+};
+
+//==============================================================================
+/** Plays one string of a WaveguideStringBank in a voice's ProcessorChain. The mono string
+    is added to every channel. The bank must have been processed for the current block
+    before the voice runs.
+*/
+template <typename Type>
+class BankedWaveguideString
+{
+public:
+    //==============================================================================
+    void setBank (WaveguideStringBank<Type>& bankToUse, size_t stringIndexToUse) noexcept
+    {
+        bank = &bankToUse;
+        stringIndex = stringIndexToUse;
+    }
+
+    //バッファは全てバンクが持っているので、ここでは何もしない
+    void prepare (const juce::dsp::ProcessSpec&) noexcept {}
+    void reset() noexcept {}
+
+    //==============================================================================
+    void setFrequency (Type newValueHz) noexcept
+    {
+        jassert (bank != nullptr);
+        bank->setFrequency (stringIndex, newValueHz);
+    }
+
+    void trigger (Type velocity) noexcept
+    {
+        jassert (bank != nullptr);
+        bank->trigger (stringIndex, velocity);
+    }
+
+    void stop() noexcept
+    {
+        jassert (bank != nullptr);
+        bank->stop (stringIndex);
+    }
+
+    bool isActive() const noexcept
+    {
+        jassert (bank != nullptr);
+        return bank->isActive (stringIndex);
+    }
+
+    //==============================================================================
+    template <typename ProcessContext>
+    void process (const ProcessContext& context) noexcept
+    {
+        auto&& inBlock = context.getInputBlock();
+        auto&& outBlock = context.getOutputBlock();
+        auto numSamples = outBlock.getNumSamples();
+        auto numChannels = outBlock.getNumChannels();
+
+        jassert (bank != nullptr && numSamples <= bank->getNumRenderedSamples());
 
-    //==============================================================================
-    void reset() noexcept
-    {
-        processorChain.reset();
+        auto* stringOutput = bank->getOutput (stringIndex);
+
+        //入力のコピーと足し込みを分けず、チャンネルごとに一度で済ませる
+        for (size_t ch = 0; ch < numChannels; ++ch)
+        {
+            if (context.usesSeparateInputAndOutputBlocks())
+                juce::FloatVectorOperations::add (outBlock.getChannelPointer (ch), inBlock.getChannelPointer (ch), stringOutput, (int) numSamples);
+            else
+                juce::FloatVectorOperations::add (outBlock.getChannelPointer (ch), stringOutput, (int) numSamples);
+        }
     }
 
 private:
     //==============================================================================
-    enum
-    {
-        filterIndex,
-        preGainIndex,
-        waveshaperIndex,
-        postGainIndex
-    };
-
-    using Filter = juce::dsp::IIR::Filter<Type>;
-    using FilterCoefs = juce::dsp::IIR::Coefficients<Type>;
-
-    juce::dsp::ProcessorChain<juce::dsp::ProcessorDuplicator<Filter, FilterCoefs>,
-                              juce::dsp::Gain<Type>, juce::dsp::WaveShaper<Type>, juce::dsp::Gain<Type>> processorChain;
+    WaveguideStringBank<Type>* bank = nullptr;
+    size_t stringIndex = 0;
 };
 
 //==============================================================================
+/** juce::dsp::Reverb only accepts float blocks, so other sample types are processed
+    through a float buffer allocated in prepare(). Apart from CabSimulator, this is the
+    only conversion left in the double-precision FX chain.
+*/
 template <typename Type>
-class WaveguideString
+class AnyPrecisionReverb
 {
 public:
-    //==============================================================================
-    WaveguideString()
-    {
-        setTriggerPosition(Type(0.2));
-        setPickupPosition(Type(0.8));
-        setDecayTime(Type(0.5));
-    }
-
     //==============================================================================
     void prepare (const juce::dsp::ProcessSpec& spec)
     {
-        sampleRateHz = (Type) spec.sampleRate;
-        //あとで使う一時的なオーディオブロックを用意
-        tempBlock = juce::dsp::AudioBlock<float> (heapBlock, spec.numChannels, spec.maximumBlockSize);
-        filter.prepare(spec);
-        //サンプリング周波数が変わった時のために、念の為パラメータをアップデートしておく
-        updateParameters();
+        reverb.prepare (spec);
+        floatBlock = juce::dsp::AudioBlock<float> (heapBlock, spec.numChannels, spec.maximumBlockSize);
     }
 
-    //==============================================================================
     void reset() noexcept
     {
-        forwardDelayLine .clear();
-        backwardDelayLine .clear();
+        reverb.reset();
     }
 
-    //==============================================================================
-    void setFrequency (Type newValueHz)
+    void setParameters (const juce::dsp::Reverb::Parameters& newParams)
     {
-        freqHz = newValueHz;
-        updateParameters();
+        reverb.setParameters (newParams);
     }
 
     //==============================================================================
-    void setPickupPosition (Type newValue)
+    template <typename ProcessContext>
+    void process (const ProcessContext& context) noexcept
     {
-        jassert (newValue >= Type (0) && newValue <= Type (1));
-        pickupPos = newValue;
-        updateParameters();
+        process (context, std::is_same<Type, float>());
     }
 
+private:
     //==============================================================================
-    void setTriggerPosition (Type newValue)
-    {
-        jassert (newValue >= Type (0) && newValue <= Type (1));
-        triggerPos = newValue;
-        updateParameters();
-    }
+    juce::dsp::Reverb reverb;
+
+    juce::HeapBlock<char> heapBlock;
+    juce::dsp::AudioBlock<float> floatBlock;
 
     //==============================================================================
-    void setDecayTime (Type newValue) noexcept
+    template <typename ProcessContext>
+    void process (const ProcessContext& context, std::true_type) noexcept
     {
-        jassert (newValue >= Type (0) && newValue <= Type (1));
-        decayTime = newValue;
-        updateParameters();
+        reverb.process (context);
     }
 
-    //==============================================================================
-    //triggerIndexで弦を摘んだ時のげんの変位
-    void trigger (Type velocity) noexcept
+    template <typename ProcessContext>
+    void process (const ProcessContext& context, std::false_type) noexcept
     {
-        jassert(velocity >= Type(0) && velocity <= Type(1));
-        //forwardDelayLineでは、
-        //バッファーに両端を0、forwardTriggerIndexを頂点とした山型の波形が書き込まれる
-        //逆に、backwardDelayLineでは左右反転させたものが書き込まれる
-        
-        //値がramp up
-        for (size_t i=0; i<= forwardTriggerIndex; ++i)
+        auto&& inputBlock = context.getInputBlock();
+        auto&& outputBlock = context.getOutputBlock();
+        auto numChannels = outputBlock.getNumChannels();
+        auto numSamples = outputBlock.getNumSamples();
+
+        jassert (numChannels <= floatBlock.getNumChannels());
+        auto block = floatBlock.getSubsetChannelBlock (0, numChannels).getSubBlock (0, numSamples);
+
+        for (size_t ch = 0; ch < numChannels; ++ch)
         {
-            auto value = juce::jmap(Type(i), Type(0), Type(forwardTriggerIndex), Type(0), velocity/2);
-            forwardDelayLine .set(i, value);
-            backwardDelayLine .set(getDelayLineLength()-1-i,value);
+            auto* src = inputBlock.getChannelPointer (ch);
+            auto* dst = block.getChannelPointer (ch);
+
+            for (size_t i = 0; i < numSamples; ++i)
+                dst[i] = (float) src[i];
         }
-        //値がramp down
-        for (size_t i=forwardTriggerIndex; i< getDelayLineLength(); ++i)
+
+        juce::dsp::ProcessContextReplacing<float> floatContext (block);
+        floatContext.isBypassed = context.isBypassed;
+        reverb.process (floatContext);
+
+        for (size_t ch = 0; ch < numChannels; ++ch)
         {
-            auto value = juce::jmap(Type(i), Type(forwardTriggerIndex), Type(getDelayLineLength()-1), velocity/2, Type(0));
-            forwardDelayLine.set(i, value);
-            backwardDelayLine.set(getDelayLineLength()-1-i, value);
+            auto* src = block.getChannelPointer (ch);
+            auto* dst = outputBlock.getChannelPointer (ch);
+
+            for (size_t i = 0; i < numSamples; ++i)
+                dst[i] = (Type) src[i];
         }
     }
+};
 
+//==============================================================================
+/** Tells when a voice has become inaudible: its peak level has stayed below a threshold for
+    longer than a hold time. Comparing with exact zero doesn't work for a decaying string,
+    which only ever gets smaller.
+*/
+template <typename Type>
+class SilenceDetector
+{
+public:
     //==============================================================================
-    template <typename ProcessContext>
-    void process (const ProcessContext& context) noexcept
+    void prepare (double sampleRate) noexcept
     {
-        auto&& outBlock = context.getOutputBlock();
-        auto numSamples = outBlock.getNumSamples();
-        auto* dst = tempBlock.getChannelPointer(0);
-        
-        for (size_t i=0; i<numSamples; ++i)
-            dst[i] = processSample();
-        
-        for (size_t ch=1; ch < tempBlock.getNumChannels(); ++ch)
-            juce::FloatVectorOperations::copy(tempBlock.getChannelPointer(ch),
-                                             tempBlock.getChannelPointer(0),
-                                             (int) numSamples);
-        
-        outBlock.copyFrom(context.getInputBlock()).add(tempBlock.getSubBlock(0, outBlock.getNumSamples()));
-        
+        sampleRateHz = sampleRate;
+        updateHoldSamples();
+        reset();
     }
 
-private:
-    //==============================================================================
-    DelayLine<Type> forwardDelayLine;
-    DelayLine<Type> backwardDelayLine;
-    juce::dsp::IIR::Filter<Type> filter;
-
-    juce::HeapBlock<char> heapBlock;
-    juce::dsp::AudioBlock<float> tempBlock;
-
-    size_t forwardPickupIndex  { 0 };
-    size_t backwardPickupIndex { 0 };
-    size_t forwardTriggerIndex { 0 };
-    Type decayCoef;
-
-    Type sampleRateHz { Type (1e3) };
-    Type freqHz       { Type (1) };
-    Type pickupPos    { Type (0) };
-    Type triggerPos   { Type (0) };
-    Type decayTime    { Type (0) };
+    void reset() noexcept
+    {
+        numSilentSamples = 0;
+    }
 
     //==============================================================================
-    size_t getDelayLineLength() const noexcept
+    /** Levels below this count as silence */
+    void setThresholdDecibels (Type newThresholdDb) noexcept
+    {
+        threshold = juce::Decibels::decibelsToGain (newThresholdDb);
+    }
+
+    /** How long the level has to stay below the threshold */
+    void setHoldTime (double newHoldTimeSeconds) noexcept
     {
-        return forwardDelayLine.size();
+        jassert (newHoldTimeSeconds >= 0.0);
+        holdTimeSeconds = newHoldTimeSeconds;
+        updateHoldSamples();
     }
 
     //==============================================================================
-    Type processSample() noexcept
+    /** Feeds the next block, and returns true once the voice has been silent for the hold time */
+    bool isSilent (const juce::dsp::AudioBlock<Type>& block) noexcept
     {
-        auto forwardOut = forwardDelayLine .back();
-        auto backwardOut = backwardDelayLine .back();
-        
-        //固定端反射 backwardDelayLineに向かう反射面では減衰する
-        forwardDelayLine .push(-backwardOut);
-        backwardDelayLine .push(-decayCoef*filter.processSample(forwardOut));
-        
-        //ピックアップ位置での合成波を取得
-        return forwardDelayLine.get(forwardPickupIndex)+backwardDelayLine.get(backwardPickupIndex);
+        auto numSamples = block.getNumSamples();
+
+        for (size_t ch = 0; ch < block.getNumChannels(); ++ch)
+        {
+            auto range = juce::FloatVectorOperations::findMinAndMax (block.getChannelPointer (ch), (int) numSamples);
+
+            //一つのチャンネルでも閾値を超えたら鳴っている
+            if (juce::jmax (-range.getStart(), range.getEnd()) > threshold)
+            {
+                numSilentSamples = 0;
+                return false;
+            }
+        }
+
+        numSilentSamples += numSamples;
+        return numSilentSamples >= holdSamples;
     }
 
+private:
     //==============================================================================
-    void updateParameters()
+    void updateHoldSamples() noexcept
     {
-        //delay周期分にlengthを合わせる
-        auto length = (size_t) juce::roundToInt(sampleRateHz / freqHz);
-        forwardDelayLine .resize(length);
-        backwardDelayLine .resize(length);
-        
-        //半分の長さまでの位置にpikupの位置を配置
-        forwardPickupIndex = (size_t) juce::roundToInt(jmap(pickupPos, Type(0), Type(length/2-1)));
-        //backwardは、波の進行方向がforwardと逆なので、中心から対象の位置にpickupを配置
-        backwardPickupIndex = length - 1 - forwardPickupIndex;
-        //DelayLineのトリガーポイント
-        forwardTriggerIndex = (size_t) juce::roundToInt(jmap(triggerPos, Type(0), Type(length/2 -1)));
-        //Delayの周波数の四倍でLPFをDecayにかける
-        filter.coefficients = juce::dsp::IIR::Coefficients<Type>::makeFirstOrderLowPass(sampleRateHz, 4*freqHz);
-        //限りなく１に近いdecay係数 0.999^length~0.99999^lengthに収まる
-        decayCoef = juce::jmap(decayTime, std::pow(Type(0.999),Type(length)),std::pow(Type(0.99999), Type(length)));
-        //一旦DelayLineをのバッファを空（0）に戻す
-        reset();
-        
+        holdSamples = (size_t) (holdTimeSeconds * sampleRateHz);
     }
+
+    double sampleRateHz = 44100.0;
+    double holdTimeSeconds = 0.05;
+    size_t holdSamples = 0, numSilentSamples = 0;
+    Type threshold = juce::Decibels::decibelsToGain (Type (-90));
 };
 
 //==============================================================================
+/** A synth voice rendering in Type precision. AudioEngine creates float or double voices
+    to match the host's processing precision.
+*/
+template <typename Type>
 class Voice  : public juce::MPESynthesiserVoice
 {
 public:
     Voice()
     {
-        auto waveform = CustomOscillator<float>::Waveform::saw;
-        processorChain.get<oscIndex>().setWaveform (waveform);
+        auto waveform = CustomOscillator<Type>::Waveform::saw;
+        processorChain.template get<oscIndex>().setWaveform (waveform);
 
-        auto& masterGain = processorChain.get<masterGainIndex>();
-        masterGain.setGainLinear (0.7f);
+        auto& masterGain = processorChain.template get<masterGainIndex>();
+        masterGain.setGainLinear (Type (0.7));
     }
 
     //==============================================================================
     void prepare (const juce::dsp::ProcessSpec& spec)
     {
-        tempBlock = juce::dsp::AudioBlock<float> (heapBlock, spec.numChannels, spec.maximumBlockSize);
+        tempBlock = juce::dsp::AudioBlock<Type> (heapBlock, spec.numChannels, spec.maximumBlockSize);
         processorChain.prepare (spec);
+        silenceDetector.prepare (spec.sampleRate);
+    }
+
+    //==============================================================================
+    /** The voice is released once its peak level stays below thresholdDb for holdTimeSeconds */
+    void setSilenceDetection (Type thresholdDb, double holdTimeSeconds) noexcept
+    {
+        silenceDetector.setThresholdDecibels (thresholdDb);
+        silenceDetector.setHoldTime (holdTimeSeconds);
+    }
+
+    /** Connects this voice to its string in the engine's WaveguideStringBank */
+    void setStringBank (WaveguideStringBank<Type>& bank, size_t index) noexcept
+    {
+        processorChain.template get<stringIndex>().setBank (bank, index);
+    }
+
+    /** The list this voice adds itself to when a note starts */
+    void setActiveVoiceList (ActiveVoiceList* list) noexcept
+    {
+        activeVoiceList = list;
     }
 
     //==============================================================================
     void noteStarted() override
     {
-        auto velocity = getCurrentlyPlayingNote().noteOnVelocity.asUnsignedFloat();
-        auto freqHz = (float) getCurrentlyPlayingNote().getFrequencyInHertz();
+        auto velocity = (Type) getCurrentlyPlayingNote().noteOnVelocity.asUnsignedFloat();
+        auto freqHz = (Type) getCurrentlyPlayingNote().getFrequencyInHertz();
 
-        processorChain.get<oscIndex>().setFrequency (freqHz, true);
+        processorChain.template get<oscIndex>().setFrequency (freqHz, true);
 
         //processorChain.get<oscIndex>().setLevel (velocity);
         
-        auto& stringModel = processorChain.get<stringIndex>();
+        auto& stringModel = processorChain.template get<stringIndex>();
         stringModel.setFrequency(freqHz);
         stringModel.trigger(velocity);
+
+        silenceDetector.reset();
+
+        if (activeVoiceList != nullptr)
+            activeVoiceList->voiceStarted (this);
     }
 
     //==============================================================================
     void notePitchbendChanged () override
     {
-        auto freqHz = (float) getCurrentlyPlayingNote().getFrequencyInHertz();
-        processorChain.get<oscIndex>().setFrequency (freqHz);
+        auto freqHz = (Type) getCurrentlyPlayingNote().getFrequencyInHertz();
+        processorChain.template get<oscIndex>().setFrequency (freqHz);
     }
 
     //==============================================================================
     void noteStopped (bool) override
     {
-        processorChain.get<oscIndex>().setLevel (0.0f);
+        processorChain.template get<oscIndex>().setLevel (Type (0));
     }
 
     //==============================================================================
@@ -702,43 +3504,18 @@ public:
     //==============================================================================
     void renderNextBlock (juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples) override
     {
-        auto block = tempBlock.getSubBlock (0, (size_t) numSamples);
-        block.clear();
-        juce::dsp::ProcessContextReplacing<float> context (block);
-        processorChain.process (context);
-
-        // silence detector
-        bool active = false;
-        for (size_t ch = 0; ch < block.getNumChannels(); ++ch)
-        {
-            auto* channelPtr = block.getChannelPointer (ch);
-
-            for (int i = 0; i < numSamples; ++i)
-            {
-                if (channelPtr[i] != 0.0f)
-                {
-                    active = true;
-                    break;
-                }
-            }
-        }
+        render (outputBuffer, startSample, numSamples);
+    }
 
-        if (active)
-        {
-            juce::dsp::AudioBlock<float> (outputBuffer)
-                .getSubBlock ((size_t) startSample, (size_t) numSamples)
-                .add (tempBlock);
-        }
-        else
-        {
-            clearCurrentNote();
-        }
+    void renderNextBlock (juce::AudioBuffer<double>& outputBuffer, int startSample, int numSamples) override
+    {
+        render (outputBuffer, startSample, numSamples);
     }
 
 private:
     //==============================================================================
     juce::HeapBlock<char> heapBlock;
-    juce::dsp::AudioBlock<float> tempBlock;
+    juce::dsp::AudioBlock<Type> tempBlock;
 
     enum
     {
@@ -747,33 +3524,186 @@ private:
         masterGainIndex
     };
 
-    juce::dsp::ProcessorChain<CustomOscillator<float>, WaveguideString<float>, juce::dsp::Gain<float>> processorChain;
+    juce::dsp::ProcessorChain<CustomOscillator<Type>, BankedWaveguideString<Type>, juce::dsp::Gain<Type>> processorChain;
+    SilenceDetector<Type> silenceDetector;
+    ActiveVoiceList* activeVoiceList = nullptr;
+
+    //==============================================================================
+    //AudioEngineはホストと同じ精度のボイスしか作らないので、違う精度のバッファは来ない
+    template <typename OtherType>
+    void render (juce::AudioBuffer<OtherType>&, int, int)
+    {
+        jassertfalse;
+    }
+
+    void render (juce::AudioBuffer<Type>& outputBuffer, int startSample, int numSamples)
+    {
+        //オシレーターも弦も止まっていれば、何も計算せずにボイスを解放する
+        if (! processorChain.template get<oscIndex>().isActive()
+             && ! processorChain.template get<stringIndex>().isActive())
+        {
+            clearCurrentNote();
+            return;
+        }
+
+        auto block = tempBlock.getSubBlock (0, (size_t) numSamples);
+        block.clear();
+        juce::dsp::ProcessContextReplacing<Type> context (block);
+        processorChain.process (context);
+
+        juce::dsp::AudioBlock<Type> (outputBuffer)
+            .getSubBlock ((size_t) startSample, (size_t) numSamples)
+            .add (block);
+
+        //聞こえなくなったらボイスを解放し、弦もバンクで計算しないようにする
+        if (silenceDetector.isSilent (block))
+        {
+            processorChain.template get<stringIndex>().stop();
+            clearCurrentNote();
+        }
+    }
 };
 
 //==============================================================================
 class AudioEngine  : public juce::MPESynthesiser
 {
 public:
-    static constexpr size_t maxNumVoices = 4;
+    static constexpr size_t defaultNumVoices = 4;
 
     //==============================================================================
-    AudioEngine()
+    /** The voices are allocated together in one pool rather than one by one. They belong to
+        the engine, not to MPESynthesiser, so don't call clearVoices() or addVoice() on it.
+    */
+    explicit AudioEngine (size_t numVoicesToUse = defaultNumVoices)
+        : numVoices (numVoicesToUse)
     {
-        for (size_t i = 0; i < maxNumVoices; ++i)
-            addVoice (new Voice);
+        jassert (numVoices > 0);
+        createVoices();
 
         setVoiceStealingEnabled (true);
+
+        setUpMultiTapDelay (floatFxChain .get<multiTapDelayIndex>());
+        setUpMultiTapDelay (doubleFxChain.get<multiTapDelayIndex>());
+
+        //キャビネットとピンポンエコーは音色を大きく変えるので、使うときだけ入れる
+        setCabSimulatorEnabled (false);
+        setMultiTapDelayEnabled (false);
+    }
+
+    ~AudioEngine() override
+    {
+        //プールのボイスを基底クラスにdeleteさせない
+        releaseVoices();
+    }
+
+    size_t getNumVoices() const noexcept    { return numVoices; }
+
+    /** Renders the voices on numThreads threads besides the audio thread. With 0, the default,
+        every voice is rendered on the audio thread. Don't call this while rendering.
+    */
+    void setNumRenderThreads (size_t numThreads)
+    {
+        numRenderThreads = numThreads;
+        prepareRenderers();
     }
 
     //==============================================================================
-    void prepare (const juce::dsp::ProcessSpec& spec) noexcept
+    /** Prepares the voices and the FX chain for the given precision. If the precision has
+        changed, the voices are recreated, so this must not be called while rendering.
+    */
+    void prepare (const juce::dsp::ProcessSpec& spec, bool useDoublePrecision = false)
     {
         setCurrentPlaybackSampleRate (spec.sampleRate);
 
-        for (auto* v : voices)
-            dynamic_cast<Voice*> (v)->prepare (spec);
+        if (useDoublePrecision != usingDoublePrecision)
+        {
+            usingDoublePrecision = useDoublePrecision;
+            createVoices();
+        }
+
+        preparedSpec = spec;
+        prepareRenderers();
 
-        fxChain.prepare (spec);
+        if (usingDoublePrecision)
+        {
+            doubleStrings.prepare (spec, numVoices);
+            prepareVoices<double> (spec);
+            doubleFxChain.prepare (spec);
+        }
+        else
+        {
+            floatStrings.prepare (spec, numVoices);
+            prepareVoices<float> (spec);
+            floatFxChain.prepare (spec);
+        }
+    }
+
+    //==============================================================================
+    /** Renders the voices, split at every MIDI event as usual, and then runs the FX chain once
+        over the whole range. This hides MPESynthesiserBase::renderNextBlock().
+    */
+    template <typename Type>
+    void renderNextBlock (juce::AudioBuffer<Type>& outputAudio, const juce::MidiBuffer& inputMidi,
+                          int startSample, int numSamples)
+    {
+        MPESynthesiser::renderNextBlock (outputAudio, inputMidi, startSample, numSamples);
+
+        //FXのパラメータはMIDIでは変わらないので、サブブロックごとに回す必要はない
+        auto block = juce::dsp::AudioBlock<Type> (outputAudio).getSubBlock ((size_t) startSample, (size_t) numSamples);
+        getFxChain (Type()).process (juce::dsp::ProcessContextReplacing<Type> (block));
+    }
+
+    /** The FX chain's latency at the current precision, valid after prepare() */
+    int getLatencySamples() const noexcept
+    {
+        return juce::roundToInt (usingDoublePrecision ? doubleFxChain.get<distortionIndex>().getLatencyInSamples()
+                                                      : (double) floatFxChain.get<distortionIndex>().getLatencyInSamples());
+    }
+
+    /** Oversamples the Distortion's waveshaper 2^factorLog2 times; 0, the default, turns it
+        off. Call prepare() afterwards, and pass the new getLatencySamples() to the host.
+    */
+    void setDistortionOversampling (size_t factorLog2)
+    {
+        floatFxChain .get<distortionIndex>().setOversampling (factorLog2);
+        doubleFxChain.get<distortionIndex>().setOversampling (factorLog2);
+    }
+
+    /** Puts the guitar cabinet (CabSimulator) in or out of the FX chain. It is out by default.
+        Don't call this while rendering.
+    */
+    void setCabSimulatorEnabled (bool shouldBeEnabled) noexcept
+    {
+        floatFxChain .setBypassed<cabSimulatorIndex> (! shouldBeEnabled);
+        doubleFxChain.setBypassed<cabSimulatorIndex> (! shouldBeEnabled);
+    }
+
+    /** Puts the ping-pong MultiTapDelay after the Delay in or out of the FX chain. It is out
+        by default. Don't call this while rendering.
+    */
+    void setMultiTapDelayEnabled (bool shouldBeEnabled) noexcept
+    {
+        floatFxChain .setBypassed<multiTapDelayIndex> (! shouldBeEnabled);
+        doubleFxChain.setBypassed<multiTapDelayIndex> (! shouldBeEnabled);
+    }
+
+    //==============================================================================
+    /** Switches the Delay between its times in seconds (0.7 s and 0.5 s, the default) and its
+        times in beats at the host tempo (1.5 and 1 beats). Don't call this while rendering.
+    */
+    void setDelayTempoSync (bool shouldSyncToTempo)
+    {
+        floatFxChain .get<delayIndex>().setTempoSync (shouldSyncToTempo);
+        doubleFxChain.get<delayIndex>().setTempoSync (shouldSyncToTempo);
+    }
+
+    /** Passes the host tempo to the Delay, used once setDelayTempoSync (true) has been called.
+        Cheap when the tempo is unchanged.
+    */
+    void setTempo (double bpm) noexcept
+    {
+        floatFxChain .get<delayIndex>().setTempo (bpm);
+        doubleFxChain.get<delayIndex>().setTempo (bpm);
     }
 
 private:
@@ -781,21 +3711,155 @@ private:
     enum
     {
         distortionIndex,
+        cabSimulatorIndex,
         delayIndex,
+        multiTapDelayIndex,
         reverbIndex
     };
 
-    juce::dsp::ProcessorChain<Distortion<float>,
-                              Delay<float>, juce::dsp::Reverb> fxChain;
+    template <typename Type>
+    using FxChain = juce::dsp::ProcessorChain<Distortion<Type>, CabSimulator<Type>, Delay<Type>,
+                                              MultiTapDelay<Type>, AnyPrecisionReverb<Type>>;
+
+    FxChain<float> floatFxChain;
+    FxChain<double> doubleFxChain;
+
+    FxChain<float>& getFxChain (float) noexcept     { return floatFxChain; }
+    FxChain<double>& getFxChain (double) noexcept   { return doubleFxChain; }
+    bool usingDoublePrecision = false;
+
+    //全ボイスの弦は、ボイスごとではなくバンクでまとめて計算する
+    WaveguideStringBank<float> floatStrings;
+    WaveguideStringBank<double> doubleStrings;
+
+    //ボイスは精度ごとに一つの連続した配列で持つ
+    size_t numVoices;
+    std::unique_ptr<Voice<float>[]> floatVoices;
+    std::unique_ptr<Voice<double>[]> doubleVoices;
+    ActiveVoiceList activeVoices;
+
+    size_t numRenderThreads = 0;
+    juce::dsp::ProcessSpec preparedSpec { 0.0, 0, 0 };
+    ParallelVoiceRenderer<float> floatRenderer;
+    ParallelVoiceRenderer<double> doubleRenderer;
+
+    //==============================================================================
+    void createVoices()
+    {
+        releaseVoices();
+        floatVoices.reset();
+        doubleVoices.reset();
+
+        if (usingDoublePrecision)
+            addVoices (doubleVoices, doubleStrings);
+        else
+            addVoices (floatVoices, floatStrings);
+
+        activeVoices.reserve (numVoices);
+    }
+
+    //ディレイの後ろに薄く足す、左右に振った3タップのピンポンエコー（setMultiTapDelayEnabled() で入れたとき）
+    template <typename Type>
+    static void setUpMultiTapDelay (MultiTapDelay<Type>& multiTapDelay)
+    {
+        multiTapDelay.setMaxDelayTime (Type (1));
+        multiTapDelay.setNumTaps (3);
+        multiTapDelay.setPingPong (true);
+        multiTapDelay.setFeedback (Type (0.2));
+        multiTapDelay.setWetLevel (Type (0.25));
+
+        for (size_t tap = 0; tap < 3; ++tap)
+        {
+            multiTapDelay.setTapDelayTime (tap, Type (0.09) * Type (tap + 1));
+            multiTapDelay.setTapGain (tap, Type (0.6) / Type (tap + 1));
+            multiTapDelay.setTapPan (tap, tap % 2 == 0 ? Type (-0.7) : Type (0.7));
+            multiTapDelay.setTapCutoffFrequency (tap, Type (6e3) / Type (tap + 1));
+        }
+    }
+
+    template <typename Type>
+    void addVoices (std::unique_ptr<Voice<Type>[]>& pool, WaveguideStringBank<Type>& strings)
+    {
+        pool.reset (new Voice<Type>[numVoices]);
+
+        for (size_t i = 0; i < numVoices; ++i)
+        {
+            pool[i].setStringBank (strings, i);
+            pool[i].setActiveVoiceList (&activeVoices);
+            addVoice (&pool[i]);
+        }
+    }
+
+    //使っていない方の精度ではスレッドを止めておく
+    void prepareRenderers()
+    {
+        if (preparedSpec.maximumBlockSize == 0)
+            return;
+
+        floatRenderer .prepare (usingDoublePrecision ? 0 : numRenderThreads, preparedSpec);
+        doubleRenderer.prepare (usingDoublePrecision ? numRenderThreads : 0, preparedSpec);
+    }
+
+    void releaseVoices()
+    {
+        const juce::ScopedLock sl (voicesLock);
+        voices.clear (false);
+        activeVoices.clear();
+    }
+
+    //==============================================================================
+    juce::MPESynthesiserVoice* findVoiceToSteal (juce::MPENote noteToStealVoiceFor) const override
+    {
+        return activeVoices.findVoiceToSteal (noteToStealVoiceFor);
+    }
+
+    //MPESynthesiser::renderNextSubBlock と同じだが、鳴っているボイスだけを回る
+    template <typename Type>
+    void renderActiveVoices (juce::AudioBuffer<Type>& outputAudio, int startSample, int numSamples,
+                             ParallelVoiceRenderer<Type>& renderer)
+    {
+        const juce::ScopedLock sl (voicesLock);
+
+        //ボイスが一つならスレッドに渡す意味がない
+        if (renderer.getNumWorkerThreads() > 0 && activeVoices.size() > 1)
+        {
+            renderer.render (activeVoices, outputAudio, startSample, numSamples);
+        }
+        else
+        {
+            for (auto* voice : activeVoices)
+                if (voice->isActive())
+                    voice->renderNextBlock (outputAudio, startSample, numSamples);
+        }
+
+        activeVoices.removeInactiveVoices();
+    }
+
+    template <typename Type>
+    void prepareVoices (const juce::dsp::ProcessSpec& spec)
+    {
+        for (auto* v : voices)
+            dynamic_cast<Voice<Type>*> (v)->prepare (spec);
+    }
 
     //==============================================================================
     void renderNextSubBlock (juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples) override
     {
-        MPESynthesiser::renderNextSubBlock (outputAudio, startSample, numSamples);
+        renderVoices (outputAudio, startSample, numSamples, floatStrings, floatRenderer);
+    }
+
+    void renderNextSubBlock (juce::AudioBuffer<double>& outputAudio, int startSample, int numSamples) override
+    {
+        renderVoices (outputAudio, startSample, numSamples, doubleStrings, doubleRenderer);
+    }
 
-        auto block = juce::dsp::AudioBlock<float> (outputAudio).getSubBlock ((size_t) startSample, (size_t) numSamples);
-        auto context = juce::dsp::ProcessContextReplacing<float> (block);
-        fxChain.process (context);
+    template <typename Type>
+    void renderVoices (juce::AudioBuffer<Type>& outputAudio, int startSample, int numSamples,
+                       WaveguideStringBank<Type>& strings, ParallelVoiceRenderer<Type>& renderer)
+    {
+        //全ボイスの弦を一度に進めてから、各ボイスが自分の弦の出力を使う
+        strings.process ((size_t) numSamples);
+        renderActiveVoices (outputAudio, startSample, numSamples, renderer);
     }
 };
 
@@ -858,7 +3922,8 @@ public:
     {}
 
     //==============================================================================
-    void process (const SampleType* data, size_t numSamples)
+    template <typename InputType>
+    void process (const InputType* data, size_t numSamples)
     {
         size_t index = 0;
 
@@ -866,7 +3931,7 @@ public:
         {
             while (index++ < numSamples)
             {
-                auto currentSample = *data++;
+                auto currentSample = (SampleType) *data++;
 
                 if (currentSample >= triggerLevel && prevSample < triggerLevel)
                 {
@@ -883,7 +3948,7 @@ public:
         {
             while (index++ < numSamples)
             {
-                buffer[numCollected++] = *data++;
+                buffer[numCollected++] = (SampleType) *data++;
 
                 if (numCollected == buffer.size())
                 {
@@ -1019,7 +4084,10 @@ public:
     //==============================================================================
     void prepareToPlay (double sampleRate, int samplesPerBlock) override
     {
-        audioEngine.prepare ({ sampleRate, (juce::uint32) samplesPerBlock, 2 });
+        //モノラルのバスならエンジンもモノラルで用意し、弦を他のチャンネルに配る手間を省く
+        audioEngine.prepare ({ sampleRate, (juce::uint32) samplesPerBlock, (juce::uint32) getTotalNumOutputChannels() },
+                             isUsingDoublePrecision());
+        setLatencySamples (audioEngine.getLatencySamples());
         midiMessageCollector.reset (sampleRate);
     }
 
@@ -1036,7 +4104,22 @@ public:
         return true;
     }
 
-    void processBlock (juce::AudioSampleBuffer& buffer, juce::MidiBuffer& midiMessages) override
+    //64bitのミックスバスで動かすホストでは、変換なしでdoubleのまま処理する
+    bool supportsDoublePrecisionProcessing() const override                { return true; }
+
+    void processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages) override
+    {
+        process (buffer, midiMessages);
+    }
+
+    void processBlock (juce::AudioBuffer<double>& buffer, juce::MidiBuffer& midiMessages) override
+    {
+        process (buffer, midiMessages);
+    }
+
+    //==============================================================================
+    template <typename SampleType>
+    void process (juce::AudioBuffer<SampleType>& buffer, juce::MidiBuffer& midiMessages)
     {
         juce::ScopedNoDenormals noDenormals;
         auto totalNumInputChannels  = getTotalNumInputChannels();
@@ -1047,6 +4130,15 @@ public:
         for (int i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
             buffer.clear (i, 0, buffer.getNumSamples());
 
+        //ホストのテンポをディレイに渡す（変わっていなければ何もしない）
+        if (auto* playHead = getPlayHead())
+        {
+            juce::AudioPlayHead::CurrentPositionInfo positionInfo;
+
+            if (playHead->getCurrentPosition (positionInfo) && positionInfo.bpm > 0.0)
+                audioEngine.setTempo (positionInfo.bpm);
+        }
+
         audioEngine.renderNextBlock (buffer, midiMessages, 0, buffer.getNumSamples());
         scopeDataCollector.process (buffer.getReadPointer (0), (size_t) buffer.getNumSamples());
     }
@@ -47,6 +47,9 @@
 
 #pragma once
 
+#include "../../Shared/Wavetables.h"
+#include "../../Shared/VoiceRendering.h"
+
 //==============================================================================
 template <typename Type>
 class CustomOscillator
@@ -55,17 +58,11 @@ public:
     //==============================================================================
     CustomOscillator()
     {
-        
+        //sawのテーブルは全てのオシレーター、プラグインのインスタンスで共有する
+        wavetable = wavetableCache->getWavetable (WavetableCache<Type>::Waveform::saw);
+
         auto& osc = processorChain.template get<oscIndex>();
-        osc.initialise ([] (Type x)
-        {
-            return juce::jmap (x,
-                               Type (-juce::MathConstants<double>::pi),
-                               Type (juce::MathConstants<double>::pi),
-                               Type (-1),
-                               Type (1));
-        }, 2);
-        
+        osc.setWavetable (wavetable.get());
     }
 
     //==============================================================================
@@ -102,6 +99,9 @@ public:
 
 private:
     //==============================================================================
+    juce::SharedResourcePointer<WavetableCache<Type>> wavetableCache;
+    std::shared_ptr<const BandLimitedWavetable<Type>> wavetable;
+
     //後でインデックスで対応するプロセスを参照できるようにする
     enum
     {
@@ -109,7 +109,7 @@ private:
         gainIndex
     };
     //Oscillator->Gainで直列に繋ぐ
-    juce::dsp::ProcessorChain<juce::dsp::Oscillator<Type>,juce::dsp::Gain<Type>> processorChain;
+    juce::dsp::ProcessorChain<WavetableOscillator<Type>,juce::dsp::Gain<Type>> processorChain;
 };
 
 //==============================================================================
@@ -125,7 +125,8 @@ public:
         filter.setCutoffFrequencyHz(1000.0f);
         filter.setResonance(0.5f);
         
-        lfo.initialise ([] (float x) { return std::sin(x); }, 128);
+        lfoWavetable = wavetableCache->getWavetable (WavetableCache<float>::Waveform::sine, 128);
+        lfo.setWavetable (lfoWavetable.get());
         lfo.setFrequency (3.0f);
     }
 
@@ -139,6 +140,12 @@ public:
         lfo.prepare ({ spec.sampleRate / lfoUpdateRate, spec.maximumBlockSize, spec.numChannels });
     }
 
+    /** The list this voice adds itself to when a note starts */
+    void setActiveVoiceList (ActiveVoiceList* list) noexcept
+    {
+        activeVoiceList = list;
+    }
+
     //==============================================================================
     void noteStarted() override
     {
@@ -153,7 +160,9 @@ public:
         
         processorChain.get<osc3Index>().setFrequency (freqHz*0.99f, true);
         processorChain.get<osc3Index>().setLevel (velocity);
-        
+
+        if (activeVoiceList != nullptr)
+            activeVoiceList->voiceStarted (this);
     }
 
     //==============================================================================
@@ -238,24 +247,60 @@ private:
     
     static constexpr size_t lfoUpdateRate = 100;
     size_t lfoUpdateCounter = lfoUpdateRate;
-    juce::dsp::Oscillator<float> lfo;
+
+    juce::SharedResourcePointer<WavetableCache<float>> wavetableCache;
+    std::shared_ptr<const BandLimitedWavetable<float>> lfoWavetable;
+    WavetableOscillator<float> lfo;
+
+    ActiveVoiceList* activeVoiceList = nullptr;
 };
 
 //==============================================================================
 class AudioEngine  : public juce::MPESynthesiser
 {
 public:
-    static constexpr auto maxNumVoices = 4;
+    static constexpr size_t defaultNumVoices = 4;
 
     //==============================================================================
-    AudioEngine()
+    /** The voices are allocated together in one pool rather than one by one. They belong to
+        the engine, not to MPESynthesiser, so don't call clearVoices() or addVoice() on it.
+    */
+    explicit AudioEngine (size_t numVoicesToUse = defaultNumVoices)
+        : numVoices (numVoicesToUse),
+          voicePool (new Voice[numVoicesToUse])
     {
-        for (auto i = 0; i < maxNumVoices; ++i)
-            addVoice (new Voice);
+        jassert (numVoices > 0);
+        activeVoices.reserve (numVoices);
+
+        for (size_t i = 0; i < numVoices; ++i)
+        {
+            voicePool[i].setActiveVoiceList (&activeVoices);
+            addVoice (&voicePool[i]);
+        }
 
         setVoiceStealingEnabled (true);
     }
 
+    ~AudioEngine() override
+    {
+        //プールのボイスを基底クラスにdeleteさせない
+        const juce::ScopedLock sl (voicesLock);
+        voices.clear (false);
+    }
+
+    size_t getNumVoices() const noexcept    { return numVoices; }
+
+    /** Renders the voices on numThreads threads besides the audio thread. With 0, the default,
+        every voice is rendered on the audio thread. Don't call this while rendering.
+    */
+    void setNumRenderThreads (size_t numThreads)
+    {
+        numRenderThreads = numThreads;
+
+        if (preparedSpec.maximumBlockSize > 0)
+            renderer.prepare (numRenderThreads, preparedSpec);
+    }
+
     //==============================================================================
     void prepare (const juce::dsp::ProcessSpec& spec) noexcept
     {
@@ -265,18 +310,50 @@ public:
             dynamic_cast<Voice*> (v)->prepare (spec);
         
         fxChain.prepare(spec);
+
+        preparedSpec = spec;
+        renderer.prepare (numRenderThreads, spec);
+    }
+
+    //==============================================================================
+    /** Renders the voices, split at every MIDI event as usual, and then runs the reverb once
+        over the whole range. This hides MPESynthesiserBase::renderNextBlock().
+    */
+    void renderNextBlock (juce::AudioBuffer<float>& outputAudio, const juce::MidiBuffer& inputMidi,
+                          int startSample, int numSamples)
+    {
+        MPESynthesiser::renderNextBlock (outputAudio, inputMidi, startSample, numSamples);
+
+        //FXのパラメータはMIDIでは変わらないので、サブブロックごとに回す必要はない
+        auto block = juce::dsp::AudioBlock<float> (outputAudio).getSubBlock ((size_t) startSample, (size_t) numSamples);
+        fxChain.process (juce::dsp::ProcessContextReplacing<float> (block));
     }
 
 private:
     //==============================================================================
+    juce::MPESynthesiserVoice* findVoiceToSteal (juce::MPENote noteToStealVoiceFor) const override
+    {
+        return activeVoices.findVoiceToSteal (noteToStealVoiceFor);
+    }
+
     void renderNextSubBlock (juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples) override
     {
-        MPESynthesiser::renderNextSubBlock (outputAudio, startSample, numSamples);
-        
-        auto block = juce::dsp::AudioBlock<float>(outputAudio);
-        auto blockToUse = block.getSubBlock((size_t) startSample,(size_t)numSamples);
-        auto contextToUse = juce::dsp::ProcessContextReplacing<float> (blockToUse);
-        fxChain.process(contextToUse);
+        //MPESynthesiser::renderNextSubBlock と同じだが、鳴っているボイスだけを回る
+        const juce::ScopedLock sl (voicesLock);
+
+        //ボイスが一つならスレッドに渡す意味がない
+        if (renderer.getNumWorkerThreads() > 0 && activeVoices.size() > 1)
+        {
+            renderer.render (activeVoices, outputAudio, startSample, numSamples);
+        }
+        else
+        {
+            for (auto* voice : activeVoices)
+                if (voice->isActive())
+                    voice->renderNextBlock (outputAudio, startSample, numSamples);
+        }
+
+        activeVoices.removeInactiveVoices();
     }
     
     enum
@@ -285,6 +362,14 @@ private:
     };
     
     juce::dsp::ProcessorChain<juce::dsp::Reverb> fxChain;
+
+    size_t numVoices;
+    std::unique_ptr<Voice[]> voicePool;
+    ActiveVoiceList activeVoices;
+
+    size_t numRenderThreads = 0;
+    juce::dsp::ProcessSpec preparedSpec { 0.0, 0, 0 };
+    ParallelVoiceRenderer<float> renderer;
 };
 
 //==============================================================================
@@ -507,7 +592,8 @@ public:
     //==============================================================================
     void prepareToPlay (double sampleRate, int samplesPerBlock) override
     {
-        audioEngine.prepare ({ sampleRate, (juce::uint32) samplesPerBlock, 2 });
+        //モノラルのバスならエンジンもモノラルで用意する
+        audioEngine.prepare ({ sampleRate, (juce::uint32) samplesPerBlock, (juce::uint32) getTotalNumOutputChannels() });
         midiMessageCollector.reset (sampleRate);
     }
 
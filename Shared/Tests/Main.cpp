@@ -0,0 +1,31 @@
+/*
+  ==============================================================================
+
+    Runs the unit tests for the headers in Shared/. See CMakeLists.txt for how
+    to build and run them; the exit code is non-zero if any test fails.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../Wavetables.h"
+
+#include "WavetableOscillatorTests.h"
+
+//==============================================================================
+static WavetableOscillatorTests wavetableOscillatorTests;
+
+//==============================================================================
+int main()
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::UnitTestRunner runner;
+    runner.runAllTests();
+
+    for (int i = 0; i < runner.getNumResults(); ++i)
+        if (runner.getResult (i)->failures > 0)
+            return 1;
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+  ==============================================================================
+
+    WavetableOscillator in place of juce::dsp::Oscillator: oscillators that
+    process the same block add up, the input survives separate input and
+    output blocks, and a bypassed oscillator leaves silence.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+class WavetableOscillatorTests  : public juce::UnitTest
+{
+public:
+    WavetableOscillatorTests()
+        : juce::UnitTest ("WavetableOscillator", "DSP")
+    {
+    }
+
+    void runTest() override
+    {
+        //どちらの周波数も解析する長さにちょうど整数周期入る
+        constexpr float firstFrequency = 440.0f;
+        constexpr float secondFrequency = 1000.0f;
+
+        WavetableCache<float> cache;
+        auto sine = cache.getWavetable (WavetableCache<float>::Waveform::sine);
+
+        beginTest ("Two oscillators on the same block are summed");
+        {
+            juce::AudioBuffer<float> buffer (numChannels, numSamples);
+            buffer.clear();
+
+            juce::dsp::AudioBlock<float> block (buffer);
+            juce::dsp::ProcessContextReplacing<float> context (block);
+
+            WavetableOscillator<float> first, second;
+            prepareOscillator (first, *sine, firstFrequency);
+            prepareOscillator (second, *sine, secondFrequency);
+
+            first.process (context);
+            second.process (context);
+
+            expectBothSines (buffer, firstFrequency, secondFrequency);
+        }
+
+        beginTest ("The input is kept with separate input and output blocks");
+        {
+            juce::AudioBuffer<float> input (numChannels, numSamples), output (numChannels, numSamples);
+            input.clear();
+
+            //前の中身が残っていないことも確かめるため、出力を埋めておく
+            for (int ch = 0; ch < numChannels; ++ch)
+                juce::FloatVectorOperations::fill (output.getWritePointer (ch), 1.0f, numSamples);
+
+            juce::dsp::AudioBlock<float> inBlock (input), outBlock (output);
+
+            WavetableOscillator<float> first, second;
+            prepareOscillator (first, *sine, firstFrequency);
+            prepareOscillator (second, *sine, secondFrequency);
+
+            first.process (juce::dsp::ProcessContextReplacing<float> (inBlock));
+            second.process (juce::dsp::ProcessContextNonReplacing<float> (inBlock, outBlock));
+
+            expectBothSines (output, firstFrequency, secondFrequency);
+        }
+
+        beginTest ("A bypassed oscillator outputs silence");
+        {
+            juce::AudioBuffer<float> buffer (numChannels, numSamples);
+
+            for (int ch = 0; ch < numChannels; ++ch)
+                juce::FloatVectorOperations::fill (buffer.getWritePointer (ch), 1.0f, numSamples);
+
+            juce::dsp::AudioBlock<float> block (buffer);
+            juce::dsp::ProcessContextReplacing<float> context (block);
+            context.isBypassed = true;
+
+            WavetableOscillator<float> oscillator;
+            prepareOscillator (oscillator, *sine, firstFrequency);
+            oscillator.process (context);
+
+            expectEquals (buffer.getMagnitude (0, numSamples), 0.0f);
+        }
+    }
+
+private:
+    //==============================================================================
+    static constexpr int numChannels = 2;
+    static constexpr int numSamples = 4800;
+
+    static void prepareOscillator (WavetableOscillator<float>& oscillator,
+                                   const BandLimitedWavetable<float>& wavetable, float frequency)
+    {
+        oscillator.setWavetable (&wavetable);
+        oscillator.prepare ({ 48000.0, (juce::uint32) numSamples, (juce::uint32) numChannels });
+        oscillator.setFrequency (frequency, true);
+    }
+
+    /** Amplitude of the sine at frequency in one channel, from a single DFT bin */
+    static double getAmplitude (const juce::AudioBuffer<float>& buffer, int channel, float frequency)
+    {
+        auto* data = buffer.getReadPointer (channel);
+        auto re = 0.0, im = 0.0;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            auto angle = juce::MathConstants<double>::twoPi * (double) frequency * (double) i / 48000.0;
+            re += (double) data[i] * std::cos (angle);
+            im -= (double) data[i] * std::sin (angle);
+        }
+
+        return 2.0 * std::sqrt (re * re + im * im) / (double) numSamples;
+    }
+
+    void expectBothSines (const juce::AudioBuffer<float>& buffer, float firstFrequency, float secondFrequency)
+    {
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            expectWithinAbsoluteError (getAmplitude (buffer, ch, firstFrequency), 1.0, 1.0e-2,
+                                       "first sine, channel " + juce::String (ch));
+            expectWithinAbsoluteError (getAmplitude (buffer, ch, secondFrequency), 1.0, 1.0e-2,
+                                       "second sine, channel " + juce::String (ch));
+        }
+    }
+};
@@ -0,0 +1,351 @@
+/*
+  ==============================================================================
+
+    The list of sounding voices and the multi-threaded voice renderer, shared by
+    DSPIntroductionTutorial and DSPDelayLineTutorial. Include it after JuceHeader.h.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+/** The voices that are currently sounding, oldest note first.
+
+    Voices add themselves when a note starts, and AudioEngine drops the ones that have gone
+    idle after each render, so rendering only visits sounding voices. Storage for every voice
+    is reserved up front, so nothing here allocates on the audio thread.
+*/
+class ActiveVoiceList
+{
+public:
+    //==============================================================================
+    void reserve (size_t numVoices)
+    {
+        voices.reserve (numVoices);
+    }
+
+    void clear() noexcept
+    {
+        voices.clear();
+    }
+
+    /** Moves the voice to the end of the list, as the newest note */
+    void voiceStarted (juce::MPESynthesiserVoice* voice) noexcept
+    {
+        jassert (voices.size() < voices.capacity() || std::find (voices.begin(), voices.end(), voice) != voices.end());
+
+        voices.erase (std::remove (voices.begin(), voices.end(), voice), voices.end());
+        voices.push_back (voice);
+    }
+
+    void removeInactiveVoices() noexcept
+    {
+        voices.erase (std::remove_if (voices.begin(), voices.end(),
+                                      [] (juce::MPESynthesiserVoice* v) { return ! v->isActive(); }),
+                      voices.end());
+    }
+
+    //==============================================================================
+    /** Picks a voice in the same order as MPESynthesiser::findVoiceToSteal(), but without
+        sorting, since the list is already oldest first:
+        - the oldest voice playing the same note number as noteToStealVoiceFor;
+        - the oldest voice whose key has been released;
+        - the oldest voice without a finger on it (only held by the sustain pedal);
+        - the oldest voice.
+        The lowest and the highest held notes are protected from the last two, and are
+        only stolen (the highest first) when every other voice is protected.
+    */
+    juce::MPESynthesiserVoice* findVoiceToSteal (juce::MPENote noteToStealVoiceFor) const noexcept
+    {
+        if (noteToStealVoiceFor.isValid())
+            for (auto* voice : voices)
+                if (voice->getCurrentlyPlayingNote().initialNote == noteToStealVoiceFor.initialNote)
+                    return voice;
+
+        //離鍵済みのボイスは保護しないので、見つかればそれ以上見なくていい
+        for (auto* voice : voices)
+            if (voice->isPlayingButReleased())
+                return voice;
+
+        //ここまで来たら全て押さえているか、サステインで伸ばしている音。一番低い音と一番高い音を探す
+        juce::MPESynthesiserVoice* low = nullptr;
+        juce::MPESynthesiserVoice* top = nullptr;
+
+        for (auto* voice : voices)
+        {
+            auto noteNumber = voice->getCurrentlyPlayingNote().initialNote;
+
+            if (low == nullptr || noteNumber < low->getCurrentlyPlayingNote().initialNote)
+                low = voice;
+
+            if (top == nullptr || noteNumber > top->getCurrentlyPlayingNote().initialNote)
+                top = voice;
+        }
+
+        //一音しか鳴っていなければ、低い方として扱う
+        if (top == low)
+            top = nullptr;
+
+        for (auto* voice : voices)
+        {
+            auto keyState = voice->getCurrentlyPlayingNote().keyState;
+
+            if (voice != low && voice != top
+                 && keyState != juce::MPENote::keyDown && keyState != juce::MPENote::keyDownAndSustained)
+                return voice;
+        }
+
+        for (auto* voice : voices)
+            if (voice != low && voice != top)
+                return voice;
+
+        return top != nullptr ? top : low;
+    }
+
+    std::vector<juce::MPESynthesiserVoice*>::const_iterator begin() const noexcept   { return voices.begin(); }
+    std::vector<juce::MPESynthesiserVoice*>::const_iterator end() const noexcept     { return voices.end(); }
+
+    size_t size() const noexcept                                        { return voices.size(); }
+    juce::MPESynthesiserVoice* operator[] (size_t index) const noexcept  { return voices[index]; }
+
+private:
+    std::vector<juce::MPESynthesiserVoice*> voices;
+};
+
+//==============================================================================
+/** Renders the active voices on a fixed set of real-time worker threads as well as on the
+    audio thread.
+
+    Voice k of the ActiveVoiceList always belongs to share k % numShares, and each share adds
+    its voices in list order into a buffer of its own. The audio thread then adds those
+    buffers to the output in share order, so the result doesn't depend on which thread
+    rendered which share.
+
+    Each share is claimed with a compare-and-swap on the block's generation number, by its
+    worker or by the audio thread, whichever comes first. For about a block and a half after
+    the last block, workers poll the generation with a back-off: a few yields, then sleeps
+    that double up to an eighth of a block. After that they sleep on an event with a short
+    timeout. The audio thread never wakes them: it renders every share that no worker has
+    claimed yet, and then waits, with the same back-off kept to short sleeps, only for shares
+    that are already being rendered. Nothing is allocated, locked or signalled on the audio
+    thread. The workers are opt-in: AudioEngine starts none unless asked to.
+*/
+template <typename Type>
+class ParallelVoiceRenderer
+{
+public:
+    //==============================================================================
+    ~ParallelVoiceRenderer()
+    {
+        stopWorkers();
+    }
+
+    /** Starts numWorkerThreads threads; with 0 everything is rendered on the calling thread.
+        Call this from the message thread while nothing is rendering.
+    */
+    void prepare (size_t numWorkerThreads, const juce::dsp::ProcessSpec& spec)
+    {
+        stopWorkers();
+
+        buffers.clear();
+        buffers.reserve (numWorkerThreads + 1);
+
+        for (size_t i = 0; i <= numWorkerThreads; ++i)
+            buffers.emplace_back ((int) spec.numChannels, (int) spec.maximumBlockSize);
+
+        shares.reset (new Share[numWorkerThreads + 1]);
+        generation.store (0, std::memory_order_relaxed);
+
+        //次のブロックを待つ時間（1.5ブロック分）と、その間に一度に眠る最長の時間（1/8ブロック）
+        pollTimeMs = 1.5e3 * spec.maximumBlockSize / spec.sampleRate;
+        workerMaxSleepMicroseconds = juce::jmax (BackOff::minSleepMicroseconds, 1.25e5 * spec.maximumBlockSize / spec.sampleRate);
+
+        for (size_t i = 0; i < numWorkerThreads; ++i)
+        {
+            workers.push_back (std::make_unique<Worker> (*this, i + 1));
+            workers.back()->startThread (juce::Thread::realtimeAudioPriority);
+        }
+    }
+
+    size_t getNumWorkerThreads() const noexcept     { return workers.size(); }
+
+    //==============================================================================
+    /** Adds every active voice into output. Call from the audio thread only. */
+    void render (const ActiveVoiceList& voicesToRender, juce::AudioBuffer<Type>& output,
+                 int startSample, int numSamples) noexcept
+    {
+        jassert (! buffers.empty() && numSamples <= buffers.front().getNumSamples());
+
+        //ジョブを書いてから世代を進めると、回っているワーカーはそれを見て動き出す（起こす必要はない）
+        jobVoices = &voicesToRender;
+        jobNumSamples = numSamples;
+        auto jobGeneration = generation.load (std::memory_order_relaxed) + 1;
+        generation.store (jobGeneration, std::memory_order_release);
+
+        //自分の分を描画した後、まだ誰も取っていない分担（眠っているワーカーの分など）も引き受ける
+        for (size_t i = 0; i < buffers.size(); ++i)
+            tryToRenderShare (i, jobGeneration);
+
+        //残りはワーカーが描画中の分担なので、間を空けながら終わるのを待つ
+        BackOff backOff (audioThreadMaxSleepMicroseconds);
+
+        for (size_t i = 0; i < buffers.size(); ++i)
+            while (shares[i].doneGeneration.load (std::memory_order_acquire) != jobGeneration)
+                backOff.pause();
+
+        //足す順番は常に分担順
+        for (auto& buffer : buffers)
+            for (int ch = 0; ch < output.getNumChannels(); ++ch)
+                output.addFrom (ch, startSample, buffer, ch, 0, numSamples);
+    }
+
+private:
+    //==============================================================================
+    /** Waits a little longer on each call: a few yields first, then sleeps that double up
+        to maxSleepMicroseconds, so that waiting doesn't keep a real-time thread busy.
+    */
+    struct BackOff
+    {
+        static constexpr double minSleepMicroseconds = 20.0;
+
+        explicit BackOff (double maxSleepMicrosecondsToUse) noexcept
+            : maxSleepMicroseconds (maxSleepMicrosecondsToUse)
+        {}
+
+        void pause() noexcept
+        {
+            if (numYields < maxYields)
+            {
+                ++numYields;
+                std::this_thread::yield();
+                return;
+            }
+
+            std::this_thread::sleep_for (std::chrono::duration<double, std::micro> (sleepMicroseconds));
+            sleepMicroseconds = juce::jmin (2.0 * sleepMicroseconds, maxSleepMicroseconds);
+        }
+
+        void reset() noexcept
+        {
+            numYields = 0;
+            sleepMicroseconds = minSleepMicroseconds;
+        }
+
+        static constexpr int maxYields = 16;
+
+        const double maxSleepMicroseconds;
+        int numYields = 0;
+        double sleepMicroseconds = minSleepMicroseconds;
+    };
+
+    //==============================================================================
+    struct Worker  : public juce::Thread
+    {
+        Worker (ParallelVoiceRenderer& ownerToUse, size_t indexToUse)
+            : juce::Thread ("Voice renderer " + juce::String ((int) indexToUse)),
+              owner (ownerToUse), index (indexToUse)
+        {}
+
+        void run() override
+        {
+            auto lastGeneration = owner.generation.load (std::memory_order_acquire);
+            auto lastBlockTimeMs = juce::Time::getMillisecondCounterHiRes();
+            BackOff backOff (owner.workerMaxSleepMicroseconds);
+
+            while (! threadShouldExit())
+            {
+                auto currentGeneration = owner.generation.load (std::memory_order_acquire);
+
+                if (currentGeneration == lastGeneration)
+                {
+                    //次のブロックはすぐ来ることが多いので、しばらくは短く眠りながら見に行き、それを過ぎたら眠る
+                    //眠っている間に来たブロックはオーディオスレッドが自分で描画するので、起こしてもらう必要はない
+                    if (juce::Time::getMillisecondCounterHiRes() - lastBlockTimeMs < owner.pollTimeMs)
+                        backOff.pause();
+                    else
+                        wakeUp.wait (1);
+
+                    continue;
+                }
+
+                lastGeneration = currentGeneration;
+                lastBlockTimeMs = juce::Time::getMillisecondCounterHiRes();
+                backOff.reset();
+
+                owner.tryToRenderShare (index, currentGeneration);
+            }
+        }
+
+        ParallelVoiceRenderer& owner;
+        const size_t index;
+        juce::WaitableEvent wakeUp;
+    };
+
+    //どの世代のブロックまで取られたか、描画し終わったか
+    struct Share
+    {
+        std::atomic<juce::uint32> claimedGeneration { 0 }, doneGeneration { 0 };
+    };
+
+    //==============================================================================
+    std::vector<juce::AudioBuffer<Type>> buffers;
+    std::unique_ptr<Share[]> shares;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::atomic<juce::uint32> generation { 0 };
+    const ActiveVoiceList* jobVoices = nullptr;
+    int jobNumSamples = 0;
+    double pollTimeMs = 0.0;
+    double workerMaxSleepMicroseconds = BackOff::minSleepMicroseconds;
+
+    //オーディオスレッドが待つのは描画中の分担だけなので、長くは眠らない
+    static constexpr double audioThreadMaxSleepMicroseconds = 50.0;
+
+    //==============================================================================
+    /** Renders the share if nobody has claimed it for this generation yet */
+    bool tryToRenderShare (size_t shareIndex, juce::uint32 jobGeneration) noexcept
+    {
+        auto& share = shares[shareIndex];
+        auto previousGeneration = jobGeneration - 1;
+
+        //前の世代のままなら、まだ誰も取っていない（遅れて来たワーカーはここで失敗する）
+        if (! share.claimedGeneration.compare_exchange_strong (previousGeneration, jobGeneration,
+                                                               std::memory_order_acquire, std::memory_order_relaxed))
+            return false;
+
+        renderShare (shareIndex);
+        share.doneGeneration.store (jobGeneration, std::memory_order_release);
+        return true;
+    }
+
+    void renderShare (size_t shareIndex) noexcept
+    {
+        juce::ScopedNoDenormals noDenormals;
+
+        auto& buffer = buffers[shareIndex];
+        buffer.clear (0, jobNumSamples);
+
+        for (auto k = shareIndex; k < jobVoices->size(); k += buffers.size())
+        {
+            auto* voice = (*jobVoices)[k];
+
+            if (voice->isActive())
+                voice->renderNextBlock (buffer, 0, jobNumSamples);
+        }
+    }
+
+    void stopWorkers()
+    {
+        for (auto& worker : workers)
+        {
+            worker->signalThreadShouldExit();
+            worker->wakeUp.signal();
+        }
+
+        for (auto& worker : workers)
+            worker->stopThread (1000);
+
+        workers.clear();
+    }
+};
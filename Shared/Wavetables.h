@@ -0,0 +1,287 @@
+/*
+  ==============================================================================
+
+    Band-limited wavetables and the oscillator that plays them, shared by
+    DSPIntroductionTutorial and DSPDelayLineTutorial. Include it after JuceHeader.h.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+/** A waveform stored as a set of band-limited tables, one per octave.
+
+    The waveform is given as the amplitudes of its sine partials, f (x) = sum b_h sin (h x)
+    for x in [-pi, pi), which is the same phase range juce::dsp::Oscillator uses. Level j
+    holds the first 2^j partials, and getTable() picks the fullest level whose partials all
+    stay below Nyquist, so the lookup never aliases. The levels only depend on
+    frequency / sample rate, so one set serves every sample rate.
+
+    The tables never change after construction, so one instance can be shared by any number
+    of oscillators (see WavetableCache).
+*/
+template <typename Type>
+class BandLimitedWavetable
+{
+public:
+    //==============================================================================
+    /** Builds the tables. partialAmplitude (h) returns b_h for 1 <= h <= numPartials;
+        partials above tableSize / 2 cannot be stored and are dropped.
+    */
+    template <typename PartialFunction>
+    BandLimitedWavetable (size_t tableSizeToUse, size_t numPartials, PartialFunction partialAmplitude)
+        : tableSize (tableSizeToUse)
+    {
+        jassert (juce::isPowerOfTwo (tableSize) && numPartials > 0);
+        numPartials = juce::jmin (numPartials, tableSize / 2);
+
+        //2^j >= numPartials となったところで全ての倍音が入るので、それ以上のレベルは要らない
+        while (((size_t) 1 << highestLevel) < numPartials)
+            ++highestLevel;
+
+        //一周期分のsinを作っておけば、h倍音のi番目は sinTable[(h * i) % tableSize] で引ける
+        std::vector<double> sinTable (tableSize);
+
+        for (size_t i = 0; i < tableSize; ++i)
+            sinTable[i] = std::sin (juce::MathConstants<double>::twoPi * (double) i / (double) tableSize);
+
+        //補間用に各テーブルの末尾に先頭のサンプルを足しておく
+        tables.resize ((highestLevel + 1) * (tableSize + 1));
+        std::vector<double> sum (tableSize, 0.0);
+        size_t partial = 1;
+
+        //下のレベルから順に、倍音を足し込みながら書き出す
+        for (size_t level = 0; level <= highestLevel; ++level)
+        {
+            auto lastPartial = juce::jmin ((size_t) 1 << level, numPartials);
+
+            for (; partial <= lastPartial; ++partial)
+            {
+                //x = -pi から始まるので sin (h (x_i - pi)) = (-1)^h sin (h x_i)
+                auto amplitude = (double) partialAmplitude (partial) * ((partial & 1) != 0 ? -1.0 : 1.0);
+
+                for (size_t i = 0; i < tableSize; ++i)
+                    sum[i] += amplitude * sinTable[(partial * i) & (tableSize - 1)];
+            }
+
+            auto* table = tables.data() + level * (tableSize + 1);
+
+            for (size_t i = 0; i < tableSize; ++i)
+                table[i] = (Type) sum[i];
+
+            table[tableSize] = table[0];
+        }
+    }
+
+    //==============================================================================
+    /** Returns the table to use for a fundamental of frequencyOverSampleRate cycles per sample.
+        It holds getTableSize() + 1 samples, the last one repeating the first.
+    */
+    const Type* getTable (Type frequencyOverSampleRate) const noexcept
+    {
+        //ナイキストを超えずに入る倍音の数。2^(level+1) 個が入るなら一つ上のレベルを使える
+        auto maxPartials = Type (0.5) / juce::jmax (frequencyOverSampleRate, std::numeric_limits<Type>::min());
+        size_t level = 0;
+
+        while (level < highestLevel && (Type) ((size_t) 2 << level) <= maxPartials)
+            ++level;
+
+        return tables.data() + level * (tableSize + 1);
+    }
+
+    size_t getTableSize() const noexcept    { return tableSize; }
+
+    /** Linearly interpolated lookup, phase in [0, 1) */
+    Type getSample (const Type* table, Type phase) const noexcept
+    {
+        auto position = phase * (Type) tableSize;
+        auto index = (size_t) position;
+        auto frac = position - (Type) index;
+
+        return table[index] + frac * (table[index + 1] - table[index]);
+    }
+
+private:
+    //==============================================================================
+    size_t tableSize;
+    size_t highestLevel = 0;
+    std::vector<Type> tables;
+};
+
+//==============================================================================
+/** Hands out read-only BandLimitedWavetables, building each (waveform, table size) only once.
+
+    Use it through juce::SharedResourcePointer<WavetableCache<Type>>, so that every oscillator
+    and every plugin instance in the process asks the same cache; with the sample type as the
+    template parameter, a table is shared per (waveform, table size, sample type). The cache
+    only keeps weak references, so a table is freed once nothing plays it any more.
+    getWavetable() may build a table, so don't call it from the audio thread.
+*/
+template <typename Type>
+class WavetableCache
+{
+public:
+    //==============================================================================
+    enum class Waveform
+    {
+        sine,
+        saw
+    };
+
+    /** Returns the shared table, building it if nobody is using it yet */
+    std::shared_ptr<const BandLimitedWavetable<Type>> getWavetable (Waveform waveform, size_t tableSize)
+    {
+        const juce::ScopedLock sl (lock);
+
+        auto& entry = wavetables[std::make_pair (waveform, tableSize)];
+        auto wavetable = entry.lock();
+
+        if (wavetable == nullptr)
+        {
+            wavetable = createWavetable (waveform, tableSize);
+            entry = wavetable;
+        }
+
+        return wavetable;
+    }
+
+    /** Same as above, with the table size that suits the waveform */
+    std::shared_ptr<const BandLimitedWavetable<Type>> getWavetable (Waveform waveform)
+    {
+        //sawは高い倍音まで入れるので長いテーブルが要る
+        return getWavetable (waveform, waveform == Waveform::saw ? 2048 : 128);
+    }
+
+private:
+    //==============================================================================
+    juce::CriticalSection lock;
+    std::map<std::pair<Waveform, size_t>, std::weak_ptr<const BandLimitedWavetable<Type>>> wavetables;
+
+    static std::shared_ptr<const BandLimitedWavetable<Type>> createWavetable (Waveform waveform, size_t tableSize)
+    {
+        switch (waveform)
+        {
+        case Waveform::saw:
+            //-1から1へのランプ x / pi = (2 / pi) sum (-1)^(h+1) sin (h x) / h
+            return std::make_shared<const BandLimitedWavetable<Type>> (tableSize, tableSize / 2, [] (size_t h)
+            {
+                return ((h & 1) != 0 ? 2.0 : -2.0) / (juce::MathConstants<double>::pi * (double) h);
+            });
+
+        case Waveform::sine:
+        default:
+            jassert (waveform == Waveform::sine);
+            return std::make_shared<const BandLimitedWavetable<Type>> (tableSize, 1, [] (size_t) { return 1.0; });
+        }
+    }
+};
+
+//==============================================================================
+/** Plays a BandLimitedWavetable. Frequency smoothing, phase and the way the input is
+    treated follow juce::dsp::Oscillator, so it can replace it in a ProcessorChain: the
+    waveform is added to the input on every channel, and a bypassed oscillator outputs
+    silence while its phase keeps running.
+*/
+template <typename Type>
+class WavetableOscillator
+{
+public:
+    //==============================================================================
+    /** The table is not owned and must outlive the oscillator */
+    void setWavetable (const BandLimitedWavetable<Type>* newWavetable) noexcept
+    {
+        wavetable = newWavetable;
+    }
+
+    void setFrequency (Type newValue, bool force = false) noexcept
+    {
+        if (force)
+            frequency.setCurrentAndTargetValue (newValue);
+        else
+            frequency.setTargetValue (newValue);
+    }
+
+    //==============================================================================
+    void prepare (const juce::dsp::ProcessSpec& spec) noexcept
+    {
+        sampleRateHz = (Type) spec.sampleRate;
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        phase = Type (0);
+        frequency.reset ((double) sampleRateHz, 0.05);
+    }
+
+    //==============================================================================
+    template <typename ProcessContext>
+    void process (const ProcessContext& context) noexcept
+    {
+        auto&& inBlock = context.getInputBlock();
+        auto&& outBlock = context.getOutputBlock();
+        auto numSamples = outBlock.getNumSamples();
+        auto numChannels = outBlock.getNumChannels();
+
+        jassert (wavetable != nullptr);
+
+        //juce::dsp::Oscillator と同じく、バイパス中は無音にして位相だけ進める
+        if (context.isBypassed)
+        {
+            outBlock.clear();
+
+            for (size_t i = 0; i < numSamples; ++i)
+                phase += frequency.getNextValue() / sampleRateHz;
+
+            phase -= std::floor (phase);
+            return;
+        }
+
+        //入力のないチャンネルは波形だけになる
+        if (context.usesSeparateInputAndOutputBlocks())
+        {
+            outBlock.copyFrom (inBlock);
+
+            for (auto ch = inBlock.getNumChannels(); ch < numChannels; ++ch)
+                outBlock.getSingleChannelBlock (ch).clear();
+        }
+
+        //ブロック中に周波数が上がっていく場合でも折り返さないよう、高い方でテーブルを選ぶ
+        auto highestFrequency = juce::jmax (frequency.getCurrentValue(), frequency.getTargetValue());
+        auto* table = wavetable->getTable (highestFrequency / sampleRateHz);
+
+        //波形は全チャンネル共通なので、1回だけ読んで各チャンネルに足す
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            auto sample = wavetable->getSample (table, phase);
+
+            for (size_t ch = 0; ch < numChannels; ++ch)
+                outBlock.getChannelPointer (ch)[i] += sample;
+
+            phase += frequency.getNextValue() / sampleRateHz;
+            phase -= std::floor (phase);
+        }
+    }
+
+    /** Like juce::dsp::Oscillator::processSample(), returns input plus the next sample */
+    Type processSample (Type input) noexcept
+    {
+        jassert (wavetable != nullptr);
+
+        auto increment = frequency.getNextValue() / sampleRateHz;
+        auto output = wavetable->getSample (wavetable->getTable (increment), phase);
+
+        phase += increment;
+        phase -= std::floor (phase);
+
+        return input + output;
+    }
+
+private:
+    //==============================================================================
+    const BandLimitedWavetable<Type>* wavetable = nullptr;
+    juce::SmoothedValue<Type> frequency;
+    Type sampleRateHz { Type (44100) };
+    Type phase { Type (0) };
+};